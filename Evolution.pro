@@ -20,6 +20,36 @@ CONFIG += c++11
 #QMAKE_CFLAGS_RELEASE += -g
 #QMAKE_LFLAGS_RELEASE =
 
+#Use the plain switch based bytecode interpreter instead of the threaded one
+#DEFINES += SWITCH_INTERPRETER
+
+#Don't fuse common op code sequences into superinstructions
+#DEFINES += NO_SUPERINSTRUCTIONS
+
+#Compile hot genomes to native x86-64 code
+#DEFINES += ENABLE_JIT
+
+#Run entities sharing a genome together in SIMD lanes. Uses AVX2 if enabled, SSE2 otherwise
+#DEFINES += BATCH_INTERPRETER
+
+#Enable AVX2, used by the batch interpreter, the food level update and the draw kernels
+#QMAKE_CXXFLAGS += -mavx2
+
+#Memoise program executions per genome, keyed on the inputs they read
+#DEFINES += DECISION_MEMO
+
+#Only update the levels of occupied tiles every tick, the others catch up when accessed
+#DEFINES += LAZY_TILES
+
+#Remove dead entities by moving the last entity into their place instead of keeping the entities in slot order
+#DEFINES += SWAP_REMOVE_DEAD_ENTITIES
+
+#Store the tiles in 8x8 blocks instead of row by row
+#DEFINES += BLOCKED_TILES
+
+#Sort the entities by their tiles every Map::EntitySortInterval ticks
+#DEFINES += SORT_ENTITIES
+
 #CONFIG(debug, debug|release) {
 #    DEFINES += DEBUG
 #}
@@ -32,9 +62,22 @@ SOURCES += main.cpp\
     position.cpp \
     map.cpp \
     action.cpp \
-    entityupdatetask.cpp \
+    entityupdater.cpp \
     bytecodedialog.cpp \
-    worker.cpp
+    worker.cpp \
+    program.cpp \
+    jit.cpp \
+    instruction.cpp \
+    genomepool.cpp \
+    entitystore.cpp \
+    batchinterpreter.cpp \
+    decisionmemo.cpp \
+    speedsorter.cpp \
+    actionresolver.cpp \
+    scheduler.cpp \
+    renderer.cpp \
+    mapsnapshot.cpp \
+    entitypool.cpp
 
 HEADERS  += mainwindow.h \
     mapviewwidget.h \
@@ -44,9 +87,24 @@ HEADERS  += mainwindow.h \
     map.h \
     enums.h \
     action.h \
-    entityupdatetask.h \
+    entityupdater.h \
     bytecodedialog.h \
-    worker.h
+    worker.h \
+    program.h \
+    jit.h \
+    instruction.h \
+    genomepool.h \
+    entitystore.h \
+    batchinterpreter.h \
+    decisionmemo.h \
+    speedsorter.h \
+    actionresolver.h \
+    scheduler.h \
+    renderer.h \
+    mapsnapshot.h \
+    randomstream.h \
+    entityhandle.h \
+    entitypool.h
 
 FORMS    += mainwindow.ui \
     bytecodedialog.ui
@@ -1,184 +1,187 @@
 #include "action.h"
 #include "map.h"
 #include "entity.h"
-Action::Action(Entity *entity, EntityProperty speed) :
-	mEntity(entity),
-	mSpeed(speed) {
+#include <cassert>
+
+Action::Action() :
+	mParam(0),
+	mType(None) {
 
 }
 
-Action::~Action() {
+Action::Action(Type type, Entity *entity, EntityProperty speed) :
+	mEntity(entity->handle()),
+	mSpeed(speed),
+	mParam(0),
+	mType(type) {
 
 }
 
-EntityProperty Action::speed() const {
-	return mSpeed;
+Action Action::move(Entity *entity, EntityProperty speed, Direction direction) {
+	Action action(Move, entity, speed);
+	action.mParam = direction;
+	return action;
 }
 
+Action Action::attack(Entity *entity, EntityProperty speed, Direction direction, EntityProperty power) {
+	Action action(Attack, entity, speed);
+	action.mParam = direction;
+	action.mValue = power;
+	return action;
+}
 
-
-MoveAction::MoveAction(Entity *entity, EntityProperty speed, Direction direction) :
-	Action(entity, speed),
-	mDirection(direction) {
+Action Action::eat(Entity *entity, EntityProperty speed, FoodType type) {
+	Action action(Eat, entity, speed);
+	action.mParam = (EntityProperty::ValueType)type;
+	return action;
 }
 
-MoveAction::~MoveAction() {
+Action Action::heal(Entity *entity, EntityProperty speed) {
+	return Action(Heal, entity, speed);
 }
 
-EntityProperty MoveAction::exec(Map *map) const {
-	int waterGenLevel = map->tile(mEntity->position()).mWaterGenLevel;
-	waterGenLevel *= waterGenLevel;
-	mEntity->energy() -= mSpeed / 5 + 6 + waterGenLevel / 1024;
-	if (map->move(mEntity, mEntity->position().targetLocation(mDirection, 1))) {
-		return EntityProperty::max();
-	}
-	return EntityProperty::min();
+Action Action::reproduce(Entity *entity, EntityProperty speed) {
+	return Action(Reproduce, entity, speed);
 }
 
-Direction MoveAction::direction() const {
-	return mDirection;
+Action Action::communicate(Entity *entity, EntityProperty speed, Entity *target, EntityProperty::ValueType id, EntityProperty value) {
+	Action action(Communicate, entity, speed);
+	action.mTarget = target->handle();
+	action.mParam = id;
+	action.mValue = value;
+	return action;
 }
 
+Action Action::drink(Entity *entity, EntityProperty speed) {
+	return Action(Drink, entity, speed);
+}
 
-AttackAction::AttackAction(Entity *entity, EntityProperty speed, Direction direction, EntityProperty power) :
-	Action(entity, speed),
-	mDirection(direction),
-	mPower(power) {
+Entity *Action::entity(const Map *map) const {
+	return map->entity(mEntity);
+}
 
+EntityProperty Action::exec(Map *map) const {
+	// Entities are only destroyed after all actions of a tick have run
+	Entity *entity = map->entity(mEntity);
+	assert(entity || mType == None);
+	switch (mType) {
+		case Move:
+			return execMove(map, entity);
+		case Attack:
+			return execAttack(map, entity);
+		case Eat:
+			return execEat(map, entity);
+		case Heal:
+			return execHeal(entity);
+		case Reproduce:
+			return execReproduce(map, entity);
+		case Communicate:
+			return execCommunicate(map, entity);
+		case Drink:
+			return execDrink(map, entity);
+		case None:
+			break;
+	}
+	assert("Executing an empty action" && 0);
+	return EntityProperty::min();
 }
 
-AttackAction::~AttackAction() {
+EntityProperty Action::execMove(Map *map, Entity *entity) const {
+	int waterGenLevel = map->waterGenLevel(entity->position());
+	waterGenLevel *= waterGenLevel;
+	entity->energy() -= mSpeed / 5 + 6 + waterGenLevel / 1024;
+	if (map->move(entity, entity->position().targetLocation(direction(), 1))) {
+		return EntityProperty::max();
+	}
+	return EntityProperty::min();
 }
 
-EntityProperty AttackAction::exec(Map *map) const {
-	Position targetPos = mEntity->position().targetLocation(mDirection, 1);
+EntityProperty Action::execAttack(Map *map, Entity *entity) const {
+	Position targetPos = entity->position().targetLocation(direction(), 1);
 	if (map->isPositionOnMap(targetPos)) {
-		Tile &tile = map->tile(targetPos);
-		int waterGenLevel = map->tile(mEntity->position()).mWaterGenLevel;
+		Entity *target = map->entity(targetPos);
+		int waterGenLevel = map->waterGenLevel(entity->position());
 		waterGenLevel *= waterGenLevel;
-		mEntity->energy() -= mSpeed / 4 + 1 + waterGenLevel / 2048;
-		if (!tile.mEntity) {//Nothing in target tile
+		entity->energy() -= mSpeed / 4 + 1 + waterGenLevel / 2048;
+		if (!target) {//Nothing in target tile
 			return EntityProperty::min();
 		}
 
 
-		EntityProperty usedPower = mEntity->energy().take(mPower / 2 + 10);
+		EntityProperty usedPower = entity->energy().take(power() / 2 + 10);
 
-		EntityProperty damageDealt = tile.mEntity->health().take((usedPower * 8).greater(2));
+		EntityProperty damageDealt = target->health().take((usedPower * 8).greater(2));
 		return damageDealt;
 	}
 	return EntityProperty::min();
 
 }
 
-Direction AttackAction::direction() const {
-	return mDirection;
-}
-
-EntityProperty AttackAction::power() const {
-	return mPower;
-}
-
-EatAction::EatAction(Entity *entity, EntityProperty speed, FoodType type) :
-	Action(entity, speed),
-	mFoodType(type) {
-
-}
-
-EatAction::~EatAction() {
-}
-
-EntityProperty EatAction::exec(Map *map) const {
-	Tile &tile = map->tile(mEntity->position());
-	EntityProperty usedEnergy = mEntity->energy().take(mSpeed / 2 + 5) + 1;
-	EntityProperty tryEat = usedEnergy.sqrt() * ((tile.mFoodLevels[(int)mFoodType] / (mEntity->foodLevelAdaption() + 20)).square() / 25 + (tile.mFoodLevels[(int)mFoodType] / 5 * (mEntity->foodLevelAdaption() / 2 + 3)/ 5));
-	EntityProperty eaten = tile.mFoodLevels[(int)mFoodType].take(tryEat) * 2;
-	mEntity->energy() += eaten.sqrt();
-	if (mEntity->energy() > mEntity->maxEnergy()) {
-		mEntity->energy() = mEntity->maxEnergy();
+EntityProperty Action::execEat(Map *map, Entity *entity) const {
+	EntityProperty &foodLevel = map->foodLevel(entity->position(), foodType());
+	EntityProperty usedEnergy = entity->energy().take(mSpeed / 2 + 5) + 1;
+	EntityProperty tryEat = usedEnergy.sqrt() * ((foodLevel / (entity->foodLevelAdaption() + 20)).square() / 25 + (foodLevel / 5 * (entity->foodLevelAdaption() / 2 + 3)/ 5));
+	EntityProperty eaten = foodLevel.take(tryEat) * 2;
+	entity->energy() += eaten.sqrt();
+	if (entity->energy() > entity->maxEnergy()) {
+		entity->energy() = entity->maxEnergy();
 	}
 	return eaten;
 }
 
-FoodType EatAction::foodType() const {
-	return mFoodType;
-}
-
-
-
-HealAction::HealAction(Entity *entity, EntityProperty speed) :
-	Action(entity, speed) {
-}
-
-HealAction::~HealAction() {
-}
-
-EntityProperty HealAction::exec(Map *) const {
-	EntityProperty used = mEntity->energy().take(mSpeed / 2 + 5);
-	mEntity->health() += used / 2;
-	if (mEntity->health() > mEntity->maxHealth()) {
-		mEntity->health() = mEntity->maxHealth();
+EntityProperty Action::execHeal(Entity *entity) const {
+	EntityProperty used = entity->energy().take(mSpeed / 2 + 5);
+	entity->health() += used / 2;
+	if (entity->health() > entity->maxHealth()) {
+		entity->health() = entity->maxHealth();
 	}
 	return used;
 }
 
-
-ReproduceAction::ReproduceAction(Entity *entity, EntityProperty speed) :
-	Action(entity, speed) {
+void Action::reserveChild(Map *map) {
+	assert(mType == Reproduce);
+	Entity *entity = map->entity(mEntity);
+	entity->energy() -= 20;
+	if (entity->energy() > mSpeed * 4 && entity->hydration() > mSpeed * 3) {
+		mTarget = map->reserveEntity()->handle();
+	}
 }
 
-ReproduceAction::~ReproduceAction() {
+void Action::buildChild(Map *map) {
+	assert(mType == Reproduce);
+	Entity *child = map->entity(mTarget);
+	if (!child) return;
+	Entity *entity = map->entity(mEntity);
+	RandomStream random = entity->randomStream(map, Entity::ChildRandom);
+	map->buildNewEntity(child, entity, random);
 }
 
-EntityProperty ReproduceAction::exec(Map *map) const {
-	mEntity->energy() -= 20;
-	if (mEntity->energy() > mSpeed * 4 && mEntity->hydration() > mSpeed * 3) {
-		Entity *child = map->createAndPlaceEntity(mEntity);
-		if (!child) {
-			return EntityProperty::min();
-		}
-
-		child->energy() = mEntity->energy().take(mSpeed * 3) / 2;
-		child->hydration() = mEntity->hydration().take(mSpeed * 3);
-		child->health() = mEntity->maxHealth() / 7;
-
-		return child->energy();
+EntityProperty Action::execReproduce(Map *map, Entity *entity) const {
+	Entity *child = map->entity(mTarget);
+	if (!child || !map->placeChild(child, entity)) {
+		return EntityProperty::min();
 	}
-	return EntityProperty::min();
-}
 
+	child->energy() = entity->energy().take(mSpeed * 3) / 2;
+	child->hydration() = entity->hydration().take(mSpeed * 3);
+	child->health() = entity->maxHealth() / 7;
 
-CommunicateAction::CommunicateAction(Entity *entity, EntityProperty speed, Entity *target, EntityProperty::ValueType id, EntityProperty value) :
-	Action(entity, speed),
-	mTarget(target),
-	mId(id),
-	mValue(value) {
+	return child->energy();
 }
 
-CommunicateAction::~CommunicateAction() {
-}
-
-EntityProperty CommunicateAction::exec(Map *) const {
-	mEntity->energy() -= mSpeed / 3;
-	EntityProperty oldValue = mTarget->loadStore(mId);
-	mTarget->saveStore(mId, mValue);
+EntityProperty Action::execCommunicate(Map *map, Entity *entity) const {
+	entity->energy() -= mSpeed / 3;
+	Entity *target = map->entity(mTarget);
+	if (!target) return EntityProperty::min();
+	EntityProperty oldValue = target->loadStore(storeId());
+	target->saveStore(storeId(), mValue);
 	return oldValue;
 }
 
-
-DrinkAction::DrinkAction(Entity *entity, EntityProperty speed) :
-	Action(entity, speed) {
-
-}
-
-DrinkAction::~DrinkAction() {
-
-}
-
-EntityProperty DrinkAction::exec(Map *map) const {
-	Tile &t = map->tile(entity()->position());
-	EntityProperty energyUsed = entity()->energy().take(mEntity->drinkEnergyCost(mSpeed));
-	EntityProperty water = (int)t.mWaterLevel.take((energyUsed + 10) * 5).value() * 60 / (20 + mEntity->hydrationAdaption().value());
-	entity()->hydration() += water;
+EntityProperty Action::execDrink(Map *map, Entity *entity) const {
+	EntityProperty &waterLevel = map->waterLevel(entity->position());
+	EntityProperty energyUsed = entity->energy().take(entity->drinkEnergyCost(map, mSpeed));
+	EntityProperty water = (int)waterLevel.take((energyUsed + 10) * 5).value() * 60 / (20 + entity->hydrationAdaption().value());
+	entity->hydration() += water;
 	return water;
 }
@@ -2,13 +2,26 @@
 #define ACTION_H
 #include "enums.h"
 #include "entityproperty.h"
+#include "entityhandle.h"
 
 class Entity;
 class Map;
 
+// Action chosen by an entity's program, executed once every program of the tick has run.
+// Actions are plain values collected in the buffers of the update tasks. The type
+// decides what exec does and which of the parameters are used: Move has a direction,
+// Attack a direction and power, Eat a food type and Communicate a target, store id and
+// value. Entities are referred to by handle, an action never outlives the tick, but
+// a destroyed target is detected instead of being written to.
+//
+// Reproduce is executed in three steps. reserveChild takes the parent's energy and a
+// pool slot for the child. It runs in action order, so the slots don't depend on the
+// threads. buildChild then builds the child and can run in parallel with other actions'
+// buildChild. exec finally places it on the map, which has to happen in action order.
 class Action {
 	public:
-		enum Type {
+		enum Type : quint8 {
+			None,
 			Move,
 			Attack,
 			Eat,
@@ -18,103 +31,106 @@ class Action {
 			Drink
 		};
 
-		Action(Entity *entity, EntityProperty speed);
-		virtual ~Action();
-		virtual Type type() const = 0;
-		virtual EntityProperty exec(Map *map) const = 0;
-		virtual bool shouldBeSpeedSorted() const = 0;
-		virtual bool canBeThreaded() const = 0;
-		EntityProperty speed() const;
-		Entity *entity() const { return mEntity; }
-	protected:
-		Entity *mEntity;
-		EntityProperty mSpeed;
-};
+		Action();
 
-class MoveAction : public Action {
-	public:
-		MoveAction(Entity *entity, EntityProperty speed, Direction direction);
-		~MoveAction();
-		Type type() const { return Move; }
-		bool shouldBeSpeedSorted() const { return true; }
-		bool canBeThreaded() const { return false; }
-		EntityProperty exec(Map *map) const;
-		Direction direction() const;
-	private:
-		Direction mDirection;
-};
+		static Action move(Entity *entity, EntityProperty speed, Direction direction);
+		static Action attack(Entity *entity, EntityProperty speed, Direction direction, EntityProperty power);
+		static Action eat(Entity *entity, EntityProperty speed, FoodType type);
+		static Action heal(Entity *entity, EntityProperty speed);
+		static Action reproduce(Entity *entity, EntityProperty speed);
+		static Action communicate(Entity *entity, EntityProperty speed, Entity *target, EntityProperty::ValueType id, EntityProperty value);
+		static Action drink(Entity *entity, EntityProperty speed);
 
-class AttackAction : public Action {
-	public:
-		AttackAction(Entity *entity, EntityProperty speed, Direction direction, EntityProperty power);
-		~AttackAction();
-		Type type() const { return Attack; }
-		bool shouldBeSpeedSorted() const { return true; }
-		bool canBeThreaded() const { return false; }
+		Type type() const;
+		bool isNone() const;
 		EntityProperty exec(Map *map) const;
+		void reserveChild(Map *map);
+		void buildChild(Map *map);
+		bool shouldBeSpeedSorted() const;
+		bool canBeThreaded() const;
+		EntityProperty speed() const;
+		EntityHandle entity() const;
+		Entity *entity(const Map *map) const;
+
 		Direction direction() const;
 		EntityProperty power() const;
+		FoodType foodType() const;
+		EntityHandle target() const;
+		EntityHandle child() const;
+		EntityProperty::ValueType storeId() const;
+		EntityProperty value() const;
 	private:
-		Direction mDirection;
-		EntityProperty mPower;
-};
+		Action(Type type, Entity *entity, EntityProperty speed);
 
-class EatAction : public Action {
-	public:
-		EatAction(Entity *entity, EntityProperty speed, FoodType type);
-		~EatAction();
-		Type type() const { return Eat; }
-		bool shouldBeSpeedSorted() const { return false; }
-		bool canBeThreaded() const { return true; }
-		EntityProperty exec(Map *map) const;
-		FoodType foodType() const;
+		EntityProperty execMove(Map *map, Entity *entity) const;
+		EntityProperty execAttack(Map *map, Entity *entity) const;
+		EntityProperty execEat(Map *map, Entity *entity) const;
+		EntityProperty execHeal(Entity *entity) const;
+		EntityProperty execReproduce(Map *map, Entity *entity) const;
+		EntityProperty execCommunicate(Map *map, Entity *entity) const;
+		EntityProperty execDrink(Map *map, Entity *entity) const;
 
-	private:
-		FoodType mFoodType;
+		EntityHandle mEntity;
+		// Communicate target or the child built for Reproduce
+		EntityHandle mTarget;
+		EntityProperty mSpeed;
+		// Direction, food type or store id
+		EntityProperty::ValueType mParam;
+		// Attack power or communicated value
+		EntityProperty mValue;
+		Type mType;
 };
 
-class HealAction : public Action {
-	public:
-		HealAction(Entity *entity, EntityProperty speed);
-		~HealAction();
-		Type type() const { return Heal; }
-		bool shouldBeSpeedSorted() const { return false; }
-		bool canBeThreaded() const { return true; }
-		EntityProperty exec(Map *map) const;
-};
+inline Action::Type Action::type() const {
+	return mType;
+}
 
-class ReproduceAction : public Action {
-	public:
-		ReproduceAction(Entity *entity, EntityProperty speed);
-		~ReproduceAction();
-		Type type() const { return Reproduce; }
-		bool shouldBeSpeedSorted() const { return false; }
-		bool canBeThreaded() const { return false; }
-		EntityProperty exec(Map *map) const;
-};
+inline bool Action::isNone() const {
+	return mType == None;
+}
 
-class CommunicateAction : public Action {
-	public:
-		CommunicateAction(Entity *entity, EntityProperty speed, Entity *target, EntityProperty::ValueType id, EntityProperty value);
-		~CommunicateAction();
-		Type type() const { return Communicate; }
-		bool shouldBeSpeedSorted() const { return false; }
-		bool canBeThreaded() const { return false; }
-		EntityProperty exec(Map *) const;
-	private:
-		Entity *mTarget;
-		EntityProperty::ValueType mId;
-		EntityProperty mValue;
-};
+inline bool Action::shouldBeSpeedSorted() const {
+	return mType == Move || mType == Attack;
+}
 
-class DrinkAction : public Action {
-	public:
-		DrinkAction(Entity *entity, EntityProperty speed);
-		~DrinkAction();
-		bool shouldBeSpeedSorted() const { return false; }
-		bool canBeThreaded() const { return true; }
-		Type type() const { return Drink; }
-		EntityProperty exec(Map *map) const;
-};
+inline bool Action::canBeThreaded() const {
+	return mType == Eat || mType == Heal || mType == Drink;
+}
+
+inline EntityProperty Action::speed() const {
+	return mSpeed;
+}
+
+inline Direction Action::direction() const {
+	return (Direction)mParam;
+}
+
+inline EntityProperty Action::power() const {
+	return mValue;
+}
+
+inline FoodType Action::foodType() const {
+	return (FoodType)mParam;
+}
+
+inline EntityHandle Action::entity() const {
+	return mEntity;
+}
+
+inline EntityHandle Action::target() const {
+	return mTarget;
+}
+
+inline EntityHandle Action::child() const {
+	return mTarget;
+}
+
+inline EntityProperty::ValueType Action::storeId() const {
+	return mParam;
+}
+
+inline EntityProperty Action::value() const {
+	return mValue;
+}
 
 #endif // ACTION_H
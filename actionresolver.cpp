@@ -0,0 +1,87 @@
+#include "actionresolver.h"
+#include "action.h"
+#include "entity.h"
+#include "map.h"
+#include "scheduler.h"
+#include <algorithm>
+
+ActionResolver::ActionResolver(Map *map, Scheduler *scheduler) :
+	mMap(map),
+	mScheduler(scheduler),
+	mWaveCount(0) {
+
+}
+
+void ActionResolver::exec(const QVector<const Action*> &actions) {
+	const int count = actions.size();
+	mWaveCount = 0;
+	if (count == 0) return;
+
+	const int tileCount = mMap->width() * mMap->height();
+	if (mTileWaves.size() != tileCount) {
+		mTileWaves.fill(0, tileCount);
+	}
+
+	// Wave of every action, from the waves of the earlier actions on its tiles. The
+	// tiles are kept, the positions change once the actions run.
+	mWaves.resize(count);
+	mTiles.resize(count * 2);
+	for (int i = 0; i < count; i++) {
+		int *tiles = mTiles.data() + i * 2;
+		footprint(actions[i], tiles);
+		int wave = mTileWaves[tiles[0]];
+		if (tiles[1] >= 0) wave = qMax(wave, mTileWaves[tiles[1]]);
+		mTileWaves[tiles[0]] = wave + 1;
+		if (tiles[1] >= 0) mTileWaves[tiles[1]] = wave + 1;
+		mWaves[i] = wave;
+		mWaveCount = qMax(mWaveCount, wave + 1);
+	}
+
+	// Counting sort by wave, keeping the execution order inside a wave
+	mWaveOffsets.fill(0, mWaveCount + 1);
+	for (int i = 0; i < count; i++) {
+		mWaveOffsets[mWaves[i] + 1]++;
+	}
+	for (int wave = 0; wave < mWaveCount; wave++) {
+		mWaveOffsets[wave + 1] += mWaveOffsets[wave];
+	}
+	mOrdered.resize(count);
+	mWaveEnds.resize(mWaveCount);
+	std::copy(mWaveOffsets.constBegin(), mWaveOffsets.constBegin() + mWaveCount, mWaveEnds.begin());
+	for (int i = 0; i < count; i++) {
+		mOrdered[mWaveEnds[mWaves[i]]++] = actions[i];
+	}
+
+	for (int wave = 0; wave < mWaveCount; wave++) {
+		const Action *const *first = mOrdered.constData() + mWaveOffsets[wave];
+		const int size = mWaveOffsets[wave + 1] - mWaveOffsets[wave];
+		if (size >= MinParallelActions && mScheduler->threadCount() > 1) {
+			Map *map = mMap;
+			mScheduler->parallelFor(size, ActionGrain, [map, first](int begin, int end) {
+				execRange(map, first + begin, end - begin);
+			});
+		}
+		else {
+			execRange(mMap, first, size);
+		}
+	}
+
+	// Only the touched tiles have to be cleared for the next exec
+	for (int tile : mTiles) {
+		if (tile >= 0) mTileWaves[tile] = 0;
+	}
+}
+
+void ActionResolver::footprint(const Action *action, int *tiles) const {
+	Position position = action->entity(mMap)->position();
+	Position target = position.targetLocation(action->direction(), 1);
+	tiles[0] = position.x + mMap->width() * position.y;
+	tiles[1] = mMap->isPositionOnMap(target) ? target.x + mMap->width() * target.y : -1;
+}
+
+void ActionResolver::execRange(Map *map, const Action *const *actions, int count) {
+	for (int i = 0; i < count; i++) {
+		EntityProperty result = actions[i]->exec(map);
+		actions[i]->entity(map)->reportActionResult(result);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef ACTIONRESOLVER_H
+#define ACTIONRESOLVER_H
+#include <QVector>
+
+class Action;
+class Map;
+class Scheduler;
+
+// Executes the speed sorted Move and Attack actions of a tick on the scheduler, with
+// exactly the results of executing them one after another in order.
+//
+// Both actions only touch the tile of the acting entity and the neighbouring tile in
+// their direction, and the entities standing on them. The acting entity can't have been
+// moved by anyone else, so these tiles are known up front. Every action is put into the
+// wave after the latest earlier action that shares one of its tiles. Actions in one wave
+// share no tile and are executed concurrently, the waves one after another. Conflicting
+// actions therefore still run in speed order.
+class ActionResolver {
+	public:
+		// Waves smaller than this are executed on the calling thread
+		static const int MinParallelActions = 256;
+		static const int ActionGrain = 256;
+
+		ActionResolver(Map *map, Scheduler *scheduler);
+
+		// actions must be in execution order
+		void exec(const QVector<const Action*> &actions);
+
+		// Number of waves of the last exec
+		int waveCount() const;
+	private:
+		// Tile indices of the entity and of the tile in the action's direction, -1 if
+		// that's off the map
+		void footprint(const Action *action, int *tiles) const;
+		static void execRange(Map *map, const Action *const *actions, int count);
+
+		Map *mMap;
+		Scheduler *mScheduler;
+		// Wave + 1 of the last action touching a tile in the current exec, 0 if none did
+		QVector<int> mTileWaves;
+		QVector<int> mWaves;
+		// Two tiles per action
+		QVector<int> mTiles;
+		QVector<int> mWaveOffsets;
+		// Where the next action of each wave goes in mOrdered
+		QVector<int> mWaveEnds;
+		QVector<const Action*> mOrdered;
+		int mWaveCount;
+};
+
+inline int ActionResolver::waveCount() const {
+	return mWaveCount;
+}
+
+#endif // ACTIONRESOLVER_H
@@ -0,0 +1,472 @@
+#include "batchinterpreter.h"
+#include "action.h"
+#include "entity.h"
+#include "map.h"
+#include "program.h"
+#include <QtAlgorithms>
+#include <cassert>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+typedef EntityProperty::ValueType LaneValue;
+
+// Saturating u16 arithmetic on all lanes. EntityProperty::max() and min() are all ones
+// and all zeros, so comparison masks are valid results as they are.
+#if defined(__AVX2__)
+struct LaneVector {
+	__m256i v;
+};
+
+inline LaneVector load(const LaneValue *p) { return { _mm256_load_si256((const __m256i*)p) }; }
+inline void store(LaneValue *p, LaneVector a) { _mm256_store_si256((__m256i*)p, a.v); }
+inline LaneVector broadcast(LaneValue x) { return { _mm256_set1_epi16((short)x) }; }
+inline LaneVector addSaturated(LaneVector a, LaneVector b) { return { _mm256_adds_epu16(a.v, b.v) }; }
+inline LaneVector subSaturated(LaneVector a, LaneVector b) { return { _mm256_subs_epu16(a.v, b.v) }; }
+inline LaneVector equalMask(LaneVector a, LaneVector b) { return { _mm256_cmpeq_epi16(a.v, b.v) }; }
+inline LaneVector bitAnd(LaneVector a, LaneVector b) { return { _mm256_and_si256(a.v, b.v) }; }
+inline LaneVector bitOr(LaneVector a, LaneVector b) { return { _mm256_or_si256(a.v, b.v) }; }
+inline LaneVector bitAndNot(LaneVector a, LaneVector b) { return { _mm256_andnot_si256(a.v, b.v) }; }
+inline LaneVector select(LaneVector mask, LaneVector a, LaneVector b) { return { _mm256_blendv_epi8(b.v, a.v, mask.v) }; }
+#elif defined(__SSE2__)
+struct LaneVector {
+	__m128i lo;
+	__m128i hi;
+};
+
+inline LaneVector load(const LaneValue *p) { return { _mm_load_si128((const __m128i*)p), _mm_load_si128((const __m128i*)p + 1) }; }
+inline void store(LaneValue *p, LaneVector a) { _mm_store_si128((__m128i*)p, a.lo); _mm_store_si128((__m128i*)p + 1, a.hi); }
+inline LaneVector broadcast(LaneValue x) { return { _mm_set1_epi16((short)x), _mm_set1_epi16((short)x) }; }
+inline LaneVector addSaturated(LaneVector a, LaneVector b) { return { _mm_adds_epu16(a.lo, b.lo), _mm_adds_epu16(a.hi, b.hi) }; }
+inline LaneVector subSaturated(LaneVector a, LaneVector b) { return { _mm_subs_epu16(a.lo, b.lo), _mm_subs_epu16(a.hi, b.hi) }; }
+inline LaneVector equalMask(LaneVector a, LaneVector b) { return { _mm_cmpeq_epi16(a.lo, b.lo), _mm_cmpeq_epi16(a.hi, b.hi) }; }
+inline LaneVector bitAnd(LaneVector a, LaneVector b) { return { _mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi) }; }
+inline LaneVector bitOr(LaneVector a, LaneVector b) { return { _mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi) }; }
+inline LaneVector bitAndNot(LaneVector a, LaneVector b) { return { _mm_andnot_si128(a.lo, b.lo), _mm_andnot_si128(a.hi, b.hi) }; }
+inline LaneVector select(LaneVector mask, LaneVector a, LaneVector b) { return bitOr(bitAnd(mask, a), bitAndNot(mask, b)); }
+#else
+struct LaneVector {
+	LaneValue v[BatchInterpreter::MaxLanes];
+};
+
+template <typename Op>
+inline LaneVector lanewise(LaneVector a, LaneVector b, Op op) {
+	LaneVector r;
+	for (int i = 0; i < BatchInterpreter::MaxLanes; i++) r.v[i] = op(a.v[i], b.v[i]);
+	return r;
+}
+
+inline LaneVector load(const LaneValue *p) { LaneVector r; for (int i = 0; i < BatchInterpreter::MaxLanes; i++) r.v[i] = p[i]; return r; }
+inline void store(LaneValue *p, LaneVector a) { for (int i = 0; i < BatchInterpreter::MaxLanes; i++) p[i] = a.v[i]; }
+inline LaneVector broadcast(LaneValue x) { LaneVector r; for (int i = 0; i < BatchInterpreter::MaxLanes; i++) r.v[i] = x; return r; }
+inline LaneVector addSaturated(LaneVector a, LaneVector b) { return lanewise(a, b, [](LaneValue x, LaneValue y) { return (LaneValue)(x + y < x ? 0xFFFF : x + y); }); }
+inline LaneVector subSaturated(LaneVector a, LaneVector b) { return lanewise(a, b, [](LaneValue x, LaneValue y) { return (LaneValue)(x < y ? 0 : x - y); }); }
+inline LaneVector equalMask(LaneVector a, LaneVector b) { return lanewise(a, b, [](LaneValue x, LaneValue y) { return (LaneValue)(x == y ? 0xFFFF : 0); }); }
+inline LaneVector bitAnd(LaneVector a, LaneVector b) { return lanewise(a, b, [](LaneValue x, LaneValue y) { return (LaneValue)(x & y); }); }
+inline LaneVector bitOr(LaneVector a, LaneVector b) { return lanewise(a, b, [](LaneValue x, LaneValue y) { return (LaneValue)(x | y); }); }
+inline LaneVector bitAndNot(LaneVector a, LaneVector b) { return lanewise(a, b, [](LaneValue x, LaneValue y) { return (LaneValue)(~x & y); }); }
+inline LaneVector select(LaneVector mask, LaneVector a, LaneVector b) { return bitOr(bitAnd(mask, a), bitAndNot(mask, b)); }
+#endif
+
+inline LaneVector isZero(LaneVector a) {
+	return equalMask(a, broadcast(0));
+}
+
+inline LaneVector isNonZero(LaneVector a) {
+	return bitAndNot(isZero(a), broadcast(0xFFFF));
+}
+
+inline LaneVector greaterMask(LaneVector a, LaneVector b) {
+	return isNonZero(subSaturated(a, b));
+}
+
+inline void storeMasked(LaneValue *p, LaneVector mask, LaneVector a) {
+	store(p, select(mask, a, load(p)));
+}
+
+alignas(32) const LaneValue laneBits[BatchInterpreter::MaxLanes] = {
+	0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80,
+	0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000, 0x8000
+};
+
+inline LaneVector laneMask(quint32 lanes) {
+	LaneVector bits = load(laneBits);
+	return equalMask(bitAnd(broadcast(lanes), bits), bits);
+}
+
+inline quint32 nonZeroLanes(const LaneValue *p, quint32 lanes) {
+	quint32 result = 0;
+	for (int i = 0; i < BatchInterpreter::MaxLanes; i++) {
+		if (p[i]) result |= 1u << i;
+	}
+	return result & lanes;
+}
+
+inline int firstLane(quint32 lanes) {
+	return qCountTrailingZeroBits(lanes);
+}
+
+}
+
+BatchInterpreter::BatchInterpreter(const Map *map) :
+	mMap(map),
+	mProgram(0),
+	mMaxInstructions(0),
+	mEntities(0),
+	mActions(0),
+	mInstructionCounters(0),
+	mWarpCount(0) {
+
+}
+
+void BatchInterpreter::exec(Entity *const *entities, int count, int maxInstructions, Action *actions, int *instructionCounters) {
+	assert(count > 0 && count <= MaxLanes);
+	mEntities = entities;
+	mActions = actions;
+	mInstructionCounters = instructionCounters;
+	mMaxInstructions = maxInstructions;
+	mProgram = &entities[0]->mGenome->program();
+	mWarpCount = 0;
+
+	for (int lane = 0; lane < MaxLanes; lane++) {
+		if (lane < count) {
+			loadLane(lane);
+			mCounter[lane] = 0;
+			pushWarp(1u << lane, entities[lane]->mExecutionPoint, 0);
+		}
+		else {
+			// Unused lanes only need defined values
+			mResult[lane] = mPrimary[lane] = mSecondary[lane] = 0;
+			mSpeed[lane] = mPower[lane] = mHealth[lane] = mMaxHealth[lane] = 0;
+			mEnergy[lane] = mHydration[lane] = mCounter[lane] = 0;
+			mMarkerX[lane] = mMarkerY[lane] = 0;
+		}
+	}
+
+	while (mWarpCount > 0) {
+		// Lowest execution point first, so the warp picks up the waiting ones as it
+		// runs forward
+		int next = 0;
+		for (int i = 1; i < mWarpCount; i++) {
+			if (mWarps[i].mExecutionPoint < mWarps[next].mExecutionPoint) next = i;
+		}
+		Warp warp = mWarps[next];
+		mWarps[next] = mWarps[--mWarpCount];
+
+		mergeWarps(warp);
+		if (mWarpCount == 0 && qPopulationCount(warp.mLanes) < MinLanes) {
+			execScalar(warp.mLanes, warp.mExecutionPoint);
+		}
+		else {
+			runWarp(warp);
+		}
+	}
+}
+
+void BatchInterpreter::pushWarp(quint32 lanes, int executionPoint, int maxCounter) {
+	for (int i = 0; i < mWarpCount; i++) {
+		if (mWarps[i].mExecutionPoint == executionPoint) {
+			mWarps[i].mLanes |= lanes;
+			mWarps[i].mMaxCounter = qMax(mWarps[i].mMaxCounter, maxCounter);
+			return;
+		}
+	}
+	assert(mWarpCount < MaxLanes);
+	Warp &warp = mWarps[mWarpCount++];
+	warp.mLanes = lanes;
+	warp.mExecutionPoint = executionPoint;
+	warp.mMaxCounter = maxCounter;
+}
+
+bool BatchInterpreter::mergeWarps(Warp &warp) {
+	for (int i = 0; i < mWarpCount; i++) {
+		if (mWarps[i].mExecutionPoint == warp.mExecutionPoint) {
+			// Warps never share an execution point, so there is at most one
+			warp.mLanes |= mWarps[i].mLanes;
+			warp.mMaxCounter = qMax(warp.mMaxCounter, mWarps[i].mMaxCounter);
+			mWarps[i] = mWarps[--mWarpCount];
+			return true;
+		}
+	}
+	return false;
+}
+
+void BatchInterpreter::runWarp(Warp warp) {
+	quint32 maskLanes = warp.mLanes;
+	LaneVector mask = laneMask(maskLanes);
+	while (true) {
+		if (mWarpCount > 0) mergeWarps(warp);
+		if (warp.mMaxCounter >= mMaxInstructions) retireSpent(warp);
+		if (!warp.mLanes) return;
+		if (warp.mLanes != maskLanes) {
+			maskLanes = warp.mLanes;
+			mask = laneMask(maskLanes);
+		}
+
+		const ProgramInstruction &ins = mProgram->instruction(warp.mExecutionPoint);
+		int executionPoint = ins.mNext;
+		switch (ins.mOpCode) {
+			case OpCode::Literal:
+				storeMasked(mResult, mask, broadcast(ins.mParam));
+				break;
+			case OpCode::LiteralPrimary:
+				storeMasked(mPrimary, mask, broadcast(ins.mParam));
+				break;
+			case OpCode::LiteralSecondary:
+				storeMasked(mSecondary, mask, broadcast(ins.mParam));
+				break;
+			case OpCode::CopyResultToPrimary:
+				storeMasked(mPrimary, mask, load(mResult));
+				break;
+			case OpCode::CopyResultToSecondary:
+				storeMasked(mSecondary, mask, load(mResult));
+				break;
+			case OpCode::Equal:
+				storeMasked(mResult, mask, equalMask(load(mPrimary), load(mSecondary)));
+				break;
+			case OpCode::Greater:
+				storeMasked(mResult, mask, greaterMask(load(mPrimary), load(mSecondary)));
+				break;
+			case OpCode::Add:
+				storeMasked(mResult, mask, addSaturated(load(mPrimary), load(mSecondary)));
+				break;
+			case OpCode::Substract:
+				storeMasked(mResult, mask, subSaturated(load(mPrimary), load(mSecondary)));
+				break;
+			case OpCode::And:
+				storeMasked(mResult, mask, bitAnd(isNonZero(load(mPrimary)), isNonZero(load(mSecondary))));
+				break;
+			case OpCode::Or:
+				storeMasked(mResult, mask, bitOr(isNonZero(load(mPrimary)), isNonZero(load(mSecondary))));
+				break;
+			case OpCode::Not:
+				storeMasked(mResult, mask, isZero(load(mPrimary)));
+				break;
+			case OpCode::True:
+				storeMasked(mResult, mask, isNonZero(load(mPrimary)));
+				break;
+			case OpCode::SetSpeed:
+				storeMasked(mSpeed, mask, broadcast(ins.mParam));
+				storeMasked(mResult, mask, broadcast(ins.mParam));
+				break;
+			case OpCode::SetPower:
+				storeMasked(mPower, mask, broadcast(ins.mParam));
+				storeMasked(mResult, mask, broadcast(ins.mParam));
+				break;
+			case OpCode::GetSpeed:
+				storeMasked(mResult, mask, load(mSpeed));
+				break;
+			case OpCode::GetPower:
+				storeMasked(mResult, mask, load(mPower));
+				break;
+			case OpCode::GetHealt:
+				storeMasked(mResult, mask, load(mHealth));
+				break;
+			case OpCode::GetMaxHealt:
+				storeMasked(mResult, mask, load(mMaxHealth));
+				break;
+			case OpCode::GetEnergy:
+				storeMasked(mResult, mask, load(mEnergy));
+				break;
+			case OpCode::CheckHydrationLevel:
+				storeMasked(mResult, mask, load(mHydration));
+				break;
+			case OpCode::SelfCheckSum:
+				storeMasked(mResult, mask, broadcast(mEntities[firstLane(warp.mLanes)]->byteCodeCheckSum().value()));
+				break;
+			case OpCode::ResetTargetMarker:
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					mMarkerX[lane] = 0;
+					mMarkerY[lane] = 0;
+				}
+				break;
+			case OpCode::MoveTargetMarker: {
+				Position offset = Position().targetLocation((Direction)ins.mParam, 1);
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					mMarkerX[lane] += offset.x;
+					mMarkerY[lane] += offset.y;
+				}
+				break;
+			}
+			case OpCode::IsTargetMarkerOnMap:
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					Position target = mEntities[lane]->mPosition + Position(mMarkerX[lane], mMarkerY[lane]);
+					mResult[lane] = mMap->isPositionOnMap(target) ? EntityProperty::max().value() : EntityProperty::min().value();
+				}
+				break;
+			case OpCode::GetFoodLevel:
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					Position target = mEntities[lane]->mPosition + Position(mMarkerX[lane], mMarkerY[lane]);
+					if (mMap->isPositionOnMap(target)) {
+						mResult[lane] = mMap->foodLevel(target, (FoodType)ins.mParam).value();
+					}
+					else {
+						mResult[lane] = EntityProperty::min().value();
+					}
+				}
+				break;
+			case OpCode::ContainsEntity:
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					Position target = mEntities[lane]->mPosition + Position(mMarkerX[lane], mMarkerY[lane]);
+					mResult[lane] = mMap->entity(target) ? EntityProperty::max().value() : EntityProperty::min().value();
+				}
+				break;
+			case OpCode::CheckWaterLevel:
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					Position target = mEntities[lane]->mPosition + Position(mMarkerX[lane], mMarkerY[lane]);
+					if (mMap->isPositionOnMap(target)) {
+						mResult[lane] = mMap->waterLevel(target).value();
+					}
+					else {
+						mResult[lane] = EntityProperty::min().value();
+					}
+				}
+				break;
+			case OpCode::CheckHeatLevel:
+				for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+					int lane = firstLane(lanes);
+					Position target = mEntities[lane]->mPosition + Position(mMarkerX[lane], mMarkerY[lane]);
+					if (mMap->isPositionOnMap(target)) {
+						mResult[lane] = mMap->heat(target);
+					}
+					else {
+						mResult[lane] = EntityProperty::min().value();
+					}
+				}
+				break;
+			case OpCode::Jump:
+				executionPoint = ins.mJumpTarget;
+				break;
+			case OpCode::ConditionalJump: {
+				quint32 taken = nonZeroLanes(mPrimary, warp.mLanes);
+				if (taken == warp.mLanes) {
+					executionPoint = ins.mJumpTarget;
+				}
+				else if (taken) {
+					storeMasked(mCounter, mask, addSaturated(load(mCounter), broadcast(1)));
+					warp.mMaxCounter++;
+
+					// Keep running the larger half. The smaller one waits for its turn,
+					// unless it is too small to be worth running in lockstep.
+					quint32 notTaken = warp.mLanes & ~taken;
+					bool continueTaken = qPopulationCount(taken) >= qPopulationCount(notTaken);
+					quint32 waiting = continueTaken ? notTaken : taken;
+					int waitingExecutionPoint = continueTaken ? ins.mNext : ins.mJumpTarget;
+					if (qPopulationCount(waiting) < MinLanes) {
+						execScalar(waiting, waitingExecutionPoint);
+					}
+					else {
+						pushWarp(waiting, waitingExecutionPoint, warp.mMaxCounter);
+					}
+
+					warp.mLanes &= ~waiting;
+					warp.mExecutionPoint = continueTaken ? ins.mJumpTarget : ins.mNext;
+					if (qPopulationCount(warp.mLanes) < MinLanes) {
+						execScalar(warp.mLanes, warp.mExecutionPoint);
+						return;
+					}
+					continue;
+				}
+				break;
+			}
+			default:
+				// Anything that touches the store, other entities or produces an
+				// action runs on the entity's own interpreter
+				warp.mLanes = stepScalar(warp.mLanes, warp.mExecutionPoint);
+				warp.mMaxCounter++;
+				warp.mExecutionPoint = executionPoint;
+				continue;
+		}
+
+		storeMasked(mCounter, mask, addSaturated(load(mCounter), broadcast(1)));
+		warp.mMaxCounter++;
+		warp.mExecutionPoint = executionPoint;
+	}
+}
+
+quint32 BatchInterpreter::stepScalar(quint32 lanes, int executionPoint) {
+	quint32 remaining = lanes;
+	for (; lanes; lanes &= lanes - 1) {
+		int lane = firstLane(lanes);
+		storeLane(lane, executionPoint);
+		Action action;
+		if (mEntities[lane]->execNext(mMap, action)) {
+			finishLane(lane, action);
+			remaining &= ~(1u << lane);
+		}
+		else {
+			loadLane(lane);
+			mCounter[lane]++;
+		}
+	}
+	return remaining;
+}
+
+void BatchInterpreter::execScalar(quint32 lanes, int executionPoint) {
+	for (; lanes; lanes &= lanes - 1) {
+		int lane = firstLane(lanes);
+		Entity *entity = mEntities[lane];
+		storeLane(lane, executionPoint);
+		int instructionCounter = mCounter[lane];
+		Action action;
+		while (instructionCounter < mMaxInstructions) {
+			if (entity->execStep(mMap, mMaxInstructions, instructionCounter, action)) break;
+		}
+		mCounter[lane] = instructionCounter;
+		finishLane(lane, action);
+	}
+}
+
+void BatchInterpreter::retireSpent(Warp &warp) {
+	warp.mMaxCounter = 0;
+	for (quint32 lanes = warp.mLanes; lanes; lanes &= lanes - 1) {
+		int lane = firstLane(lanes);
+		if (mCounter[lane] >= mMaxInstructions) {
+			storeLane(lane, warp.mExecutionPoint);
+			finishLane(lane, Action());
+			warp.mLanes &= ~(1u << lane);
+		}
+		else {
+			warp.mMaxCounter = qMax(warp.mMaxCounter, (int)mCounter[lane]);
+		}
+	}
+}
+
+void BatchInterpreter::loadLane(int lane) {
+	const Entity *entity = mEntities[lane];
+	mResult[lane] = entity->mResultRegister.value();
+	mPrimary[lane] = entity->mPrimaryRegister.value();
+	mSecondary[lane] = entity->mSecondaryRegister.value();
+	mSpeed[lane] = entity->mSpeed.value();
+	mPower[lane] = entity->mPower.value();
+	mHealth[lane] = entity->mHealth.value();
+	mMaxHealth[lane] = entity->mMaxHealth.value();
+	mEnergy[lane] = entity->mEnergy.value();
+	mHydration[lane] = entity->mHydration.value();
+	mMarkerX[lane] = entity->mTargetMarker.x;
+	mMarkerY[lane] = entity->mTargetMarker.y;
+}
+
+void BatchInterpreter::storeLane(int lane, int executionPoint) {
+	Entity *entity = mEntities[lane];
+	entity->mResultRegister = mResult[lane];
+	entity->mPrimaryRegister = mPrimary[lane];
+	entity->mSecondaryRegister = mSecondary[lane];
+	entity->mSpeed = mSpeed[lane];
+	entity->mPower = mPower[lane];
+	entity->mTargetMarker = Position(mMarkerX[lane], mMarkerY[lane]);
+	entity->mExecutionPoint = executionPoint;
+}
+
+void BatchInterpreter::finishLane(int lane, const Action &action) {
+	mActions[lane] = action;
+	mInstructionCounters[lane] = mCounter[lane];
+}
@@ -0,0 +1,76 @@
+#ifndef BATCHINTERPRETER_H
+#define BATCHINTERPRETER_H
+#include "entityproperty.h"
+#include <QtGlobal>
+
+class Action;
+class Entity;
+class Map;
+class Program;
+
+// Runs the programs of entities sharing a genome in lockstep, one entity per SIMD lane.
+// Register instructions are executed for all lanes at once and instructions that read
+// tiles are executed lane by lane. Everything else (the store, other entities, actions)
+// goes through the entity's own interpreter one instruction at a time.
+//
+// Lanes that disagree on a ConditionalJump are split into warps, which are merged again
+// when they reach the same instruction. A warp with fewer than MinLanes lanes is
+// finished on the scalar interpreter.
+//
+// Entities of a batch run interleaved and out of entity order. That doesn't change the
+// results, programs only see other entities through the state beginUpdate published.
+class BatchInterpreter {
+	public:
+		static const int MaxLanes = 16;
+		static const int MinLanes = 4;
+
+		BatchInterpreter(const Map *map);
+
+		// Entities must share a genome and count must be at most MaxLanes.
+		// Results are written to actions and instructionCounters, one per entity. Entities
+		// that didn't choose an action get an empty one.
+		void exec(Entity *const *entities, int count, int maxInstructions, Action *actions, int *instructionCounters);
+	private:
+		struct Warp {
+			quint32 mLanes;
+			int mExecutionPoint;
+			int mMaxCounter;
+		};
+
+		void runWarp(Warp warp);
+		void pushWarp(quint32 lanes, int executionPoint, int maxCounter);
+		bool mergeWarps(Warp &warp);
+		void execScalar(quint32 lanes, int executionPoint);
+		quint32 stepScalar(quint32 lanes, int executionPoint);
+		void retireSpent(Warp &warp);
+
+		void loadLane(int lane);
+		void storeLane(int lane, int executionPoint);
+		void finishLane(int lane, const Action &action);
+
+		const Map *mMap;
+		const Program *mProgram;
+		int mMaxInstructions;
+		Entity *const *mEntities;
+		Action *mActions;
+		int *mInstructionCounters;
+
+		// Waiting warps, disjoint and each at a different execution point
+		Warp mWarps[MaxLanes];
+		int mWarpCount;
+
+		alignas(32) EntityProperty::ValueType mResult[MaxLanes];
+		alignas(32) EntityProperty::ValueType mPrimary[MaxLanes];
+		alignas(32) EntityProperty::ValueType mSecondary[MaxLanes];
+		alignas(32) EntityProperty::ValueType mSpeed[MaxLanes];
+		alignas(32) EntityProperty::ValueType mPower[MaxLanes];
+		alignas(32) EntityProperty::ValueType mHealth[MaxLanes];
+		alignas(32) EntityProperty::ValueType mMaxHealth[MaxLanes];
+		alignas(32) EntityProperty::ValueType mEnergy[MaxLanes];
+		alignas(32) EntityProperty::ValueType mHydration[MaxLanes];
+		alignas(32) EntityProperty::ValueType mCounter[MaxLanes];
+		int mMarkerX[MaxLanes];
+		int mMarkerY[MaxLanes];
+};
+
+#endif // BATCHINTERPRETER_H
@@ -0,0 +1,480 @@
+#include "decisionmemo.h"
+#include "entity.h"
+#include "map.h"
+#include "program.h"
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <cassert>
+
+struct DecisionMemo::Trace {
+	int mStartExecutionPoint;
+	Read mReads[MaxReads];
+	int mReadCount;
+	StoreWrite mStoreWrites[MaxStoreWrites];
+	Result mResult;
+
+	// Too many reads to be worth recording. The execution itself is still valid.
+	bool mRecordable;
+};
+
+DecisionMemo::DecisionMemo(const Program *program) :
+	mProgram(program) {
+
+}
+
+bool DecisionMemo::exec(Entity *entity, const Map *map, int maxInstructions, int &instructionCounter, Action &action, bool &acted) {
+	Result result;
+	StoreWrite storeWrites[MaxStoreWrites];
+	if (lookup(entity, map, result, storeWrites)) {
+		// The same store writes can evict entries from a fuller store, which the
+		// recorded execution never saw
+		if (!canApplyStoreWrites(entity, storeWrites, result.mStoreWriteCount)) {
+			mFallbacks.ref();
+			return false;
+		}
+		mHits.ref();
+		acted = apply(entity, map, result, storeWrites, instructionCounter, action);
+		return true;
+	}
+
+	Trace t;
+	if (!trace(entity, map, maxInstructions, t)) {
+		mFallbacks.ref();
+		return false;
+	}
+	mMisses.ref();
+	if (t.mRecordable) record(t);
+	acted = apply(entity, map, t.mResult, t.mStoreWrites, instructionCounter, action);
+	return true;
+}
+
+int DecisionMemo::memoryUsage() const {
+	QReadLocker locker(&mLock);
+	// Rough hash node cost: key, value and next pointer
+	return mNodes.size() * sizeof(Node) +
+			mResults.size() * sizeof(Result) +
+			mStoreWrites.size() * sizeof(StoreWrite) +
+			mEdges.size() * (sizeof(quint64) + sizeof(int) + sizeof(void*) * 2) +
+			mRoots.size() * (sizeof(int) * 2 + sizeof(void*) * 2);
+}
+
+bool DecisionMemo::lookup(const Entity *entity, const Map *map, Result &result, StoreWrite *storeWrites) {
+	QReadLocker locker(&mLock);
+	int node = mRoots.value(entity->mExecutionPoint, -1);
+	while (node >= 0) {
+		const Node &n = mNodes.at(node);
+		if (n.mInput == Outcome) {
+			result = mResults.at(n.mResult);
+			for (int i = 0; i < result.mStoreWriteCount; i++) {
+				storeWrites[i] = mStoreWrites.at(result.mFirstStoreWrite + i);
+			}
+			return true;
+		}
+		quint32 value = readInput(entity, map, n.mInput, n.mParam, n.mX, n.mY);
+		node = mEdges.value(edgeKey(node, value), -1);
+	}
+	return false;
+}
+
+// Same semantics as Entity::execOp, except that actions end the execution instead of
+// being created, and every value that doesn't come from the program itself is read
+// through readInput and recorded.
+bool DecisionMemo::trace(const Entity *entity, const Map *map, int maxInstructions, Trace &t) const {
+	t.mReadCount = 0;
+	t.mRecordable = true;
+	Result &r = t.mResult;
+	r.mWritten = 0;
+	r.mAction = false;
+	r.mStoreWriteCount = 0;
+
+	quint8 known = 0;
+	EntityProperty resultRegister;
+	EntityProperty primaryRegister;
+	EntityProperty secondaryRegister;
+	EntityProperty speed;
+	EntityProperty power;
+	int markerX = 0;
+	int markerY = 0;
+	EntityStore store = entity->mStore;
+
+	// Every input is read once, later reads of it see the same value
+	auto read = [&](Input input, EntityProperty::ValueType param, int x, int y) -> quint32 {
+		for (int i = 0; i < t.mReadCount; i++) {
+			const Read &previous = t.mReads[i];
+			if (previous.mInput == input && previous.mParam == param && previous.mX == x && previous.mY == y) return previous.mValue;
+		}
+		quint32 value = readInput(entity, map, input, param, x, y);
+		if (t.mReadCount == MaxReads) {
+			t.mRecordable = false;
+			return value;
+		}
+		Read &added = t.mReads[t.mReadCount++];
+		added.mInput = input;
+		added.mParam = param;
+		added.mX = x;
+		added.mY = y;
+		added.mValue = value;
+		return value;
+	};
+	auto use = [&](Register reg, EntityProperty &value) -> EntityProperty & {
+		static const Input inputs[] = {InitialResult, InitialPrimary, InitialSecondary, InitialSpeed, InitialPower};
+		if (!(known & reg)) {
+			value = read(inputs[qCountTrailingZeroBits((quint32)reg)], 0, 0, 0);
+			known |= reg;
+		}
+		return value;
+	};
+	auto write = [&](Register reg, EntityProperty &target, EntityProperty value) {
+		target = value;
+		known |= reg;
+		r.mWritten |= reg;
+	};
+	auto marker = [&]() {
+		if (!(known & TargetMarkerRegister)) {
+			// The marker is never clamped, so each coordinate is a full 32 bit read
+			markerX = (qint32)read(InitialTargetMarkerX, 0, 0, 0);
+			markerY = (qint32)read(InitialTargetMarkerY, 0, 0, 0);
+			known |= TargetMarkerRegister;
+		}
+	};
+	auto sense = [&](Input input, EntityProperty::ValueType param) -> quint32 {
+		marker();
+		return read(input, param, markerX, markerY);
+	};
+
+	int executionPoint = entity->mExecutionPoint;
+	int counter = 0;
+	t.mStartExecutionPoint = executionPoint;
+	while (counter < maxInstructions) {
+		const ProgramInstruction &ins = mProgram->instruction(executionPoint);
+		int next = ins.mNext;
+		switch (ins.mOpCode) {
+			case OpCode::Literal:
+				write(ResultRegister, resultRegister, ins.mParam);
+				break;
+			case OpCode::LiteralPrimary:
+				write(PrimaryRegister, primaryRegister, ins.mParam);
+				break;
+			case OpCode::LiteralSecondary:
+				write(SecondaryRegister, secondaryRegister, ins.mParam);
+				break;
+			case OpCode::Copy: {
+				EntityProperty value = use(ResultRegister, resultRegister);
+				// Writes that would evict an entry aren't memoised
+				if (!store.contains(ins.mParam) && store.size() == EntityStore::Capacity) return false;
+				int slot = 0;
+				while (slot < r.mStoreWriteCount && t.mStoreWrites[slot].mId != ins.mParam) slot++;
+				if (slot == r.mStoreWriteCount) {
+					if (slot == MaxStoreWrites) return false;
+					t.mStoreWrites[slot].mId = ins.mParam;
+					r.mStoreWriteCount++;
+				}
+				t.mStoreWrites[slot].mValue = value.value();
+				store.insert(ins.mParam, value);
+				break;
+			}
+			case OpCode::CopyResultToPrimary:
+				write(PrimaryRegister, primaryRegister, use(ResultRegister, resultRegister));
+				break;
+			case OpCode::CopyResultToSecondary:
+				write(SecondaryRegister, secondaryRegister, use(ResultRegister, resultRegister));
+				break;
+			case OpCode::Load: {
+				bool written = false;
+				for (int i = 0; i < r.mStoreWriteCount; i++) {
+					if (t.mStoreWrites[i].mId == ins.mParam) written = true;
+				}
+				if (written) {
+					write(ResultRegister, resultRegister, store.value(ins.mParam));
+				}
+				else {
+					write(ResultRegister, resultRegister, read(Store, ins.mParam, 0, 0));
+				}
+				break;
+			}
+			case OpCode::Equal:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister).equal(use(SecondaryRegister, secondaryRegister)));
+				break;
+			case OpCode::Greater:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister) > use(SecondaryRegister, secondaryRegister) ? EntityProperty::max() : EntityProperty::min());
+				break;
+			case OpCode::Add:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister) + use(SecondaryRegister, secondaryRegister));
+				break;
+			case OpCode::Substract:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister) - use(SecondaryRegister, secondaryRegister));
+				break;
+			case OpCode::And:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister).logicalAnd(use(SecondaryRegister, secondaryRegister)));
+				break;
+			case OpCode::Or:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister).logicalOr(use(SecondaryRegister, secondaryRegister)));
+				break;
+			case OpCode::Not:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister).logicalNot());
+				break;
+			case OpCode::True:
+				write(ResultRegister, resultRegister, use(PrimaryRegister, primaryRegister).binarized());
+				break;
+			case OpCode::SetSpeed:
+				write(SpeedRegister, speed, ins.mParam);
+				write(ResultRegister, resultRegister, speed);
+				break;
+			case OpCode::SetPower:
+				write(PowerRegister, power, ins.mParam);
+				write(ResultRegister, resultRegister, power);
+				break;
+			case OpCode::GetSpeed:
+				write(ResultRegister, resultRegister, use(SpeedRegister, speed));
+				break;
+			case OpCode::GetPower:
+				write(ResultRegister, resultRegister, use(PowerRegister, power));
+				break;
+			case OpCode::GetHealt:
+				write(ResultRegister, resultRegister, read(Health, 0, 0, 0));
+				break;
+			case OpCode::GetMaxHealt:
+				write(ResultRegister, resultRegister, read(MaxHealth, 0, 0, 0));
+				break;
+			case OpCode::GetEnergy:
+				write(ResultRegister, resultRegister, read(Energy, 0, 0, 0));
+				break;
+			case OpCode::CheckHydrationLevel:
+				write(ResultRegister, resultRegister, read(Hydration, 0, 0, 0));
+				break;
+			case OpCode::ResetTargetMarker:
+				markerX = 0;
+				markerY = 0;
+				known |= TargetMarkerRegister;
+				r.mWritten |= TargetMarkerRegister;
+				break;
+			case OpCode::MoveTargetMarker: {
+				marker();
+				Position moved = Position(markerX, markerY).targetLocation((Direction)ins.mParam, 1);
+				markerX = moved.x;
+				markerY = moved.y;
+				r.mWritten |= TargetMarkerRegister;
+				break;
+			}
+			case OpCode::IsTargetMarkerOnMap:
+				write(ResultRegister, resultRegister, sense(TargetMarkerOnMap, 0));
+				break;
+			case OpCode::GetFoodLevel:
+				write(ResultRegister, resultRegister, sense(FoodLevel, ins.mParam));
+				break;
+			case OpCode::ContainsEntity:
+				write(ResultRegister, resultRegister, sense(EntityPresent, 0) ? EntityProperty::max() : EntityProperty::min());
+				break;
+			case OpCode::EntityCheckSum:
+				write(ResultRegister, resultRegister, sense(EntityCheckSum, 0));
+				break;
+			case OpCode::SelfCheckSum:
+				write(ResultRegister, resultRegister, entity->byteCodeCheckSum());
+				break;
+			case OpCode::CheckEntityHealth:
+				write(ResultRegister, resultRegister, sense(EntityHealth, 0));
+				break;
+			case OpCode::CheckEntitySpeed:
+				write(ResultRegister, resultRegister, sense(EntitySpeed, 0));
+				break;
+			case OpCode::LoadEntityStore:
+				write(ResultRegister, resultRegister, sense(OtherEntityStore, ins.mParam));
+				break;
+			case OpCode::CheckWaterLevel:
+				write(ResultRegister, resultRegister, sense(WaterLevel, 0));
+				break;
+			case OpCode::CheckHeatLevel:
+				write(ResultRegister, resultRegister, sense(HeatLevel, 0));
+				break;
+			case OpCode::ConditionalJump:
+				if (!use(PrimaryRegister, primaryRegister).isMin()) next = ins.mJumpTarget;
+				break;
+			case OpCode::Jump:
+				next = ins.mJumpTarget;
+				break;
+			case OpCode::CopyEntityStore:
+				if (!sense(EntityPresent, 0)) {
+					write(ResultRegister, resultRegister, EntityProperty::min());
+					break;
+				}
+				r.mAction = true;
+				break;
+			case OpCode::Eat:
+			case OpCode::Move:
+			case OpCode::Attack:
+			case OpCode::Heal:
+			case OpCode::Reproduce:
+			case OpCode::Drink:
+				r.mAction = true;
+				break;
+			default:
+				assert("Unexpected op code" && 0);
+		}
+		if (r.mAction) break;
+		executionPoint = next;
+		counter++;
+	}
+
+	r.mResult = resultRegister.value();
+	r.mPrimary = primaryRegister.value();
+	r.mSecondary = secondaryRegister.value();
+	r.mSpeed = speed.value();
+	r.mPower = power.value();
+	r.mTargetMarkerX = markerX;
+	r.mTargetMarkerY = markerY;
+	r.mExecutionPoint = executionPoint;
+	r.mInstructions = counter;
+	return true;
+}
+
+void DecisionMemo::record(const Trace &t) {
+	QWriteLocker locker(&mLock);
+	if (mNodes.size() + t.mReadCount + 1 > MaxNodes) return;
+
+	int node;
+	QHash<int, int>::const_iterator root = mRoots.constFind(t.mStartExecutionPoint);
+	if (root != mRoots.constEnd()) {
+		node = root.value();
+	}
+	else {
+		node = addNode(t.mReadCount ? &t.mReads[0] : 0, t);
+		mRoots.insert(t.mStartExecutionPoint, node);
+	}
+
+	for (int i = 0; i < t.mReadCount; i++) {
+		// Executions that agree on every earlier input read the same next input
+		assert(mNodes.at(node).mInput == t.mReads[i].mInput);
+		quint64 key = edgeKey(node, t.mReads[i].mValue);
+		QHash<quint64, int>::const_iterator edge = mEdges.constFind(key);
+		if (edge != mEdges.constEnd()) {
+			node = edge.value();
+			continue;
+		}
+		int child = addNode(i + 1 < t.mReadCount ? &t.mReads[i + 1] : 0, t);
+		mEdges.insert(key, child);
+		node = child;
+	}
+}
+
+int DecisionMemo::addNode(const Read *read, const Trace &trace) {
+	Node node;
+	if (read) {
+		node.mInput = read->mInput;
+		node.mParam = read->mParam;
+		node.mX = read->mX;
+		node.mY = read->mY;
+		node.mResult = -1;
+	}
+	else {
+		node.mInput = Outcome;
+		node.mParam = 0;
+		node.mX = 0;
+		node.mY = 0;
+		node.mResult = mResults.size();
+		Result result = trace.mResult;
+		result.mFirstStoreWrite = mStoreWrites.size();
+		for (int i = 0; i < result.mStoreWriteCount; i++) {
+			mStoreWrites.append(trace.mStoreWrites[i]);
+		}
+		mResults.append(result);
+	}
+	mNodes.append(node);
+	return mNodes.size() - 1;
+}
+
+bool DecisionMemo::apply(Entity *entity, const Map *map, const Result &result, const StoreWrite *storeWrites, int &instructionCounter, Action &action) const {
+	if (result.mWritten & ResultRegister) entity->mResultRegister = result.mResult;
+	if (result.mWritten & PrimaryRegister) entity->mPrimaryRegister = result.mPrimary;
+	if (result.mWritten & SecondaryRegister) entity->mSecondaryRegister = result.mSecondary;
+	if (result.mWritten & SpeedRegister) entity->mSpeed = result.mSpeed;
+	if (result.mWritten & PowerRegister) entity->mPower = result.mPower;
+	if (result.mWritten & TargetMarkerRegister) entity->mTargetMarker = Position(result.mTargetMarkerX, result.mTargetMarkerY);
+	for (int i = 0; i < result.mStoreWriteCount; i++) {
+		entity->mStore.insert(storeWrites[i].mId, storeWrites[i].mValue);
+	}
+	if (result.mStoreWriteCount) entity->mStoreChanged = true;
+	entity->mExecutionPoint = result.mExecutionPoint;
+	instructionCounter = result.mInstructions;
+	if (!result.mAction) return false;
+
+	// Run the action instruction itself, it sees the same state as it did when recorded
+	bool acted = entity->execNext(map, action);
+	assert(acted);
+	return acted;
+}
+
+bool DecisionMemo::canApplyStoreWrites(const Entity *entity, const StoreWrite *storeWrites, int count) {
+	if (count == 0) return true;
+	EntityStore store = entity->mStore;
+	for (int i = 0; i < count; i++) {
+		if (!store.contains(storeWrites[i].mId)) {
+			if (store.size() == EntityStore::Capacity) return false;
+			store.insert(storeWrites[i].mId, storeWrites[i].mValue);
+		}
+	}
+	return true;
+}
+
+quint32 DecisionMemo::readInput(const Entity *entity, const Map *map, Input input, EntityProperty::ValueType param, qint32 x, qint32 y) {
+	Position target = entity->mPosition + Position(x, y);
+	switch (input) {
+		case InitialResult:
+			return entity->mResultRegister.value();
+		case InitialPrimary:
+			return entity->mPrimaryRegister.value();
+		case InitialSecondary:
+			return entity->mSecondaryRegister.value();
+		case InitialSpeed:
+			return entity->mSpeed.value();
+		case InitialPower:
+			return entity->mPower.value();
+		case InitialTargetMarkerX:
+			return (quint32)entity->mTargetMarker.x;
+		case InitialTargetMarkerY:
+			return (quint32)entity->mTargetMarker.y;
+		case Health:
+			return entity->mHealth.value();
+		case MaxHealth:
+			return entity->mMaxHealth.value();
+		case Energy:
+			return entity->mEnergy.value();
+		case Hydration:
+			return entity->mHydration.value();
+		case Store:
+			return entity->mStore.value(param).value();
+		case TargetMarkerOnMap:
+			return map->isPositionOnMap(target) ? EntityProperty::max().value() : EntityProperty::min().value();
+		case FoodLevel:
+			return map->isPositionOnMap(target) ? map->foodLevel(target, (FoodType)param).value() : EntityProperty::min().value();
+		case WaterLevel:
+			return map->isPositionOnMap(target) ? map->waterLevel(target).value() : EntityProperty::min().value();
+		case HeatLevel:
+			return map->isPositionOnMap(target) ? map->heat(target) : EntityProperty::min().value();
+		case EntityPresent:
+			return map->entity(target) ? 1 : 0;
+		case EntityCheckSum: {
+			const Entity *other = map->entity(target);
+			return other ? other->byteCodeCheckSum().value() : EntityProperty::min().value();
+		}
+		case EntityHealth: {
+			const Entity *other = map->entity(target);
+			return other ? other->sensed().mHealth.value() : EntityProperty::min().value();
+		}
+		case EntitySpeed: {
+			const Entity *other = map->entity(target);
+			return other ? other->sensed().mSpeed.value() : EntityProperty::min().value();
+		}
+		case OtherEntityStore: {
+			const Entity *other = map->entity(target);
+			return other ? other->sensed().mStore.value(param).value() : EntityProperty::min().value();
+		}
+		case Outcome:
+			break;
+	}
+	assert("Not an input" && 0);
+	return 0;
+}
+
+quint64 DecisionMemo::edgeKey(int node, quint32 value) {
+	return ((quint64)node << 32) | value;
+}
@@ -0,0 +1,171 @@
+#ifndef DECISIONMEMO_H
+#define DECISIONMEMO_H
+#include "entityproperty.h"
+#include "entitystore.h"
+#include <QVector>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QAtomicInt>
+
+class Action;
+class Entity;
+class Map;
+class Program;
+
+// Executions of the memos of all genomes since the statistics were last taken
+struct DecisionMemoStatistics {
+	// Answered from a memo
+	int mHits;
+	// Traced and then applied, recorded unless they read too much
+	int mMisses;
+	// Left to the entity, as they couldn't be traced or their store writes applied
+	int mFallbacks;
+	// Bytes the memos take
+	int mMemory;
+};
+
+// Memoised executions of one genome's program.
+// An execution is fully determined by its starting execution point and the values it
+// reads: the entity's registers and stats, its store, and the tiles and entities under
+// the target marker. Every recorded execution is a path in a decision tree, where each
+// node names the next input the program read and each edge is one value of it. The
+// leaf holds the outcome: the written registers and store entries, the instruction
+// count, and the execution point of the instruction that produced the action.
+//
+// Looking up an entity walks the tree reading the same inputs from it. On a hit the
+// outcome is applied and the action instruction is run on the entity as usual.
+class DecisionMemo {
+	public:
+		DecisionMemo(const Program *program);
+
+		// Runs the entity's program using the memo, recording the execution on a miss.
+		// acted tells whether an action was stored in action.
+		// Returns false if the execution can't be memoised, the entity is left untouched
+		// and has to run its program itself.
+		bool exec(Entity *entity, const Map *map, int maxInstructions, int &instructionCounter, Action &action, bool &acted);
+
+		int hits() const;
+		int misses() const;
+		int fallbacks() const;
+		void resetCounters();
+		int memoryUsage() const;
+	private:
+		enum Input : quint8 {
+			InitialResult,
+			InitialPrimary,
+			InitialSecondary,
+			InitialSpeed,
+			InitialPower,
+			InitialTargetMarkerX,
+			InitialTargetMarkerY,
+			Health,
+			MaxHealth,
+			Energy,
+			Hydration,
+			Store,
+			TargetMarkerOnMap,
+			FoodLevel,
+			WaterLevel,
+			HeatLevel,
+			EntityPresent,
+			EntityCheckSum,
+			EntityHealth,
+			EntitySpeed,
+			OtherEntityStore,
+			Outcome
+		};
+
+		enum Register : quint8 {
+			ResultRegister = 0x1,
+			PrimaryRegister = 0x2,
+			SecondaryRegister = 0x4,
+			SpeedRegister = 0x8,
+			PowerRegister = 0x10,
+			TargetMarkerRegister = 0x20
+		};
+
+		// Input read by an execution. mX and mY are the target marker at the time of
+		// the read, mParam is the food type or store id.
+		struct Read {
+			Input mInput;
+			EntityProperty::ValueType mParam;
+			qint32 mX;
+			qint32 mY;
+			quint32 mValue;
+		};
+
+		struct StoreWrite {
+			EntityProperty::ValueType mId;
+			EntityProperty::ValueType mValue;
+		};
+
+		struct Result {
+			quint8 mWritten;
+			bool mAction;
+			EntityProperty::ValueType mResult;
+			EntityProperty::ValueType mPrimary;
+			EntityProperty::ValueType mSecondary;
+			EntityProperty::ValueType mSpeed;
+			EntityProperty::ValueType mPower;
+			qint32 mTargetMarkerX;
+			qint32 mTargetMarkerY;
+			int mExecutionPoint;
+			int mInstructions;
+			int mFirstStoreWrite;
+			int mStoreWriteCount;
+		};
+
+		struct Node {
+			Input mInput;
+			EntityProperty::ValueType mParam;
+			qint32 mX;
+			qint32 mY;
+			int mResult;
+		};
+
+		static const int MaxReads = 32;
+		static const int MaxStoreWrites = EntityStore::Capacity;
+		static const int MaxNodes = 1 << 14;
+
+		struct Trace;
+
+		bool lookup(const Entity *entity, const Map *map, Result &result, StoreWrite *storeWrites);
+		bool trace(const Entity *entity, const Map *map, int maxInstructions, Trace &trace) const;
+		void record(const Trace &trace);
+		bool apply(Entity *entity, const Map *map, const Result &result, const StoreWrite *storeWrites, int &instructionCounter, Action &action) const;
+		static bool canApplyStoreWrites(const Entity *entity, const StoreWrite *storeWrites, int count);
+		static quint32 readInput(const Entity *entity, const Map *map, Input input, EntityProperty::ValueType param, qint32 x, qint32 y);
+		int addNode(const Read *read, const Trace &trace);
+		static quint64 edgeKey(int node, quint32 value);
+
+		const Program *mProgram;
+		mutable QReadWriteLock mLock;
+		QHash<int, int> mRoots;
+		QHash<quint64, int> mEdges;
+		QVector<Node> mNodes;
+		QVector<Result> mResults;
+		QVector<StoreWrite> mStoreWrites;
+		QAtomicInt mHits;
+		QAtomicInt mMisses;
+		QAtomicInt mFallbacks;
+};
+
+inline int DecisionMemo::hits() const {
+	return mHits.load();
+}
+
+inline int DecisionMemo::misses() const {
+	return mMisses.load();
+}
+
+inline int DecisionMemo::fallbacks() const {
+	return mFallbacks.load();
+}
+
+inline void DecisionMemo::resetCounters() {
+	mHits.store(0);
+	mMisses.store(0);
+	mFallbacks.store(0);
+}
+
+#endif // DECISIONMEMO_H
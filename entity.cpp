@@ -1,9 +1,17 @@
 #include "entity.h"
 #include "map.h"
 #include "action.h"
+#include "entitypool.h"
 #include <cassert>
 #include <QDataStream>
 #include <iostream>
+#include <random>
+
+EntityColdData::EntityColdData() :
+	mGeneration(1),
+	mFoodLevelAdaption(20) {
+
+}
 
 Entity::Entity() :
 	mHealth(100),
@@ -13,18 +21,46 @@ Entity::Entity() :
 	mSpeed(10),
 	mPower(10),
 	mHydration(100),
-	mLifeTime(0),
 	mHydrationAdaption(20),
-	mFoodLevelAdaption(20),
 	mBornState(-20),
-	mGeneration(1),
+	mStoreChanged(false),
 	mExecutionEnergyUsageCounter(0),
-	mRandomizer(std::random_device()()){
+	mLifeTime(0),
+	mId(0) {
 
 }
 
 Entity::~Entity() {
 }
+
+EntityColdData &Entity::cold() {
+	return EntityPool::cold(this);
+}
+
+const EntityColdData &Entity::cold() const {
+	return EntityPool::cold(const_cast<Entity*>(this));
+}
+
+EntitySensedState &Entity::sensed() {
+	return EntityPool::sensed(this);
+}
+
+const EntitySensedState &Entity::sensed() const {
+	return EntityPool::sensed(const_cast<Entity*>(this));
+}
+
+quint64 Entity::id() const {
+	return mId;
+}
+
+void Entity::setId(quint64 id) {
+	mId = id;
+}
+
+EntityHandle Entity::handle() const {
+	return mHandle;
+}
+
 Position Entity::position() const {
 	return mPosition;
 }
@@ -33,35 +69,49 @@ void Entity::setPosition(const Position &position) {
 	mPosition = position;
 }
 
-Action *Entity::update(const Map *map) {
+bool Entity::beginUpdate(const Map *map) {
 	mLifeTime++;
-	if (mBornState >= 0) {
-		if (mHydration == 0) {
-			mEnergy -= 3;
-			mHealth -= 4;
-		}
-		else if (mHydration < 50 - mHydrationAdaption.sqrt().value()) {
-			mEnergy -= 1;
-		}
-		std::uniform_int_distribution<> dist(0, (int)map->tile(position()).mHeat * 150 / (6 + mHydrationAdaption.sqrt().value()));
-		mHydration -= EntityProperty(22 + dist(mRandomizer) / 50) - mHydrationAdaption.sqrt();
+	const bool active = mBornState >= 0;
+	if (active) {
+		updateHydration(map);
+	}
+	else {
+		mBornState++;
+	}
 
+	EntitySensedState &state = sensed();
+	state.mHealth = mHealth;
+	state.mSpeed = mSpeed;
+	if (mStoreChanged) {
+		state.mStore = mStore;
+		mStoreChanged = false;
+	}
+	return active;
+}
 
-		int instructionCounter;
-		const int maxInstructions = 1000;
-		Action *action = exec(map, maxInstructions, instructionCounter);
-		mExecutionEnergyUsageCounter += mByteCode.size() + instructionCounter + mMaxHealth.value() + mMaxEnergy.value();
-		while (mExecutionEnergyUsageCounter > 600) {
-			mEnergy -= 1;
-			mExecutionEnergyUsageCounter -= 600;
-		}
+void Entity::updateHydration(const Map *map) {
+	if (mHydration == 0) {
+		mEnergy -= 3;
+		mHealth -= 4;
+	}
+	else if (mHydration < 50 - mHydrationAdaption.sqrt().value()) {
 		mEnergy -= 1;
-		return action;
 	}
-	else {
-		mBornState++;
-		return 0;
+	std::uniform_int_distribution<> dist(0, (int)map->heat(position()) * 150 / (6 + mHydrationAdaption.sqrt().value()));
+	RandomStream random = randomStream(map, HydrationRandom);
+	mHydration -= EntityProperty(22 + dist(random) / 50) - mHydrationAdaption.sqrt();
+}
+
+void Entity::endUpdate(int instructionCounter) {
+#ifdef ENABLE_JIT
+	mGenome->program().reportExecution(instructionCounter, mGenome->population());
+#endif
+	mExecutionEnergyUsageCounter += mGenome->byteCode().size() + instructionCounter + mMaxHealth.value() + mMaxEnergy.value();
+	while (mExecutionEnergyUsageCounter > 600) {
+		mEnergy -= 1;
+		mExecutionEnergyUsageCounter -= 600;
 	}
+	mEnergy -= 1;
 }
 
 EntityProperty &Entity::health() {
@@ -91,33 +141,72 @@ void Entity::reportActionResult(EntityProperty success) {
 	mResultRegister = success;
 }
 
-EntityProperty Entity::byteCodeCheckSum() {
-	EntityProperty::ValueType checkSum = 0;
-	for (const Instruction &ins : mByteCode) {
-		checkSum ^= (EntityProperty::ValueType)ins.mOpCode;
-		checkSum = (checkSum << 1) | (checkSum >> (sizeof(checkSum)*CHAR_BIT-1));
-	}
-	EntityProperty ret(checkSum);
-	if (ret == EntityProperty::min()) ret = EntityProperty::max();
-	return ret;
+EntityProperty Entity::byteCodeCheckSum() const {
+	return mGenome->checkSum();
 }
 
-Action *Entity::exec(const Map *map, const int maxInstruction, int &instructionCounter) {
+bool Entity::exec(const Map *map, const int maxInstruction, int &instructionCounter, Action &action) {
 	instructionCounter = 0;
-	Action *action = execInstruction(map, instruction());
-	nextInstruction();
-	if (action != nullptr) return action;
-	instructionCounter++;
-	for (;instructionCounter < maxInstruction; instructionCounter++) {
-		action = execInstruction(map, instruction());
-		nextInstruction();
-		if (action != nullptr) return action;
+#ifdef DECISION_MEMO
+	bool acted;
+	if (mGenome->memo().exec(this, map, maxInstruction, instructionCounter, action, acted)) return acted;
+#endif
+#ifdef ENABLE_JIT
+	const JitCode *nativeCode = mGenome->program().nativeCode();
+	if (nativeCode) return execNative(map, nativeCode, maxInstruction, instructionCounter, action);
+#endif
+	while (instructionCounter < maxInstruction) {
+		if (execStep(map, maxInstruction, instructionCounter, action)) return true;
 	}
-	return 0;
+	return false;
 }
 
-Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
-	switch (ins.mOpCode) {
+#ifdef ENABLE_JIT
+bool Entity::execNative(const Map *map, const JitCode *code, const int maxInstruction, int &instructionCounter, Action &action) {
+	JitState state;
+	while (instructionCounter < maxInstruction) {
+		toJitState(state);
+		state.mBudget = maxInstruction - instructionCounter;
+		code->run(&state);
+		fromJitState(state);
+		instructionCounter = maxInstruction - state.mBudget;
+		if (instructionCounter >= maxInstruction) break;
+
+		// Native code stopped at an instruction it doesn't handle
+		if (execStep(map, maxInstruction, instructionCounter, action)) return true;
+	}
+	return false;
+}
+
+void Entity::toJitState(JitState &state) const {
+	state.mResultRegister = mResultRegister.value();
+	state.mPrimaryRegister = mPrimaryRegister.value();
+	state.mSecondaryRegister = mSecondaryRegister.value();
+	state.mTargetMarkerX = mTargetMarker.x;
+	state.mTargetMarkerY = mTargetMarker.y;
+	state.mExecutionPoint = mExecutionPoint;
+	state.mSpeed = mSpeed.value();
+	state.mPower = mPower.value();
+	state.mHealth = mHealth.value();
+	state.mMaxHealth = mMaxHealth.value();
+	state.mEnergy = mEnergy.value();
+	state.mHydration = mHydration.value();
+}
+
+void Entity::fromJitState(const JitState &state) {
+	mResultRegister = state.mResultRegister;
+	mPrimaryRegister = state.mPrimaryRegister;
+	mSecondaryRegister = state.mSecondaryRegister;
+	mTargetMarker = Position(state.mTargetMarkerX, state.mTargetMarkerY);
+	mExecutionPoint = state.mExecutionPoint;
+	mSpeed = state.mSpeed;
+	mPower = state.mPower;
+}
+#endif
+
+template <OpCode Code>
+inline bool Entity::execOp(const Map *map, const ProgramInstruction &ins, Action &action) {
+	switch (Code) {
 		case OpCode::Literal:
 			mResultRegister = ins.mParam;
 			break;
@@ -128,7 +217,8 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 			mSecondaryRegister = ins.mParam;
 			break;
 		case OpCode::Copy:
-			mData[ins.mParam] = mResultRegister;
+			mStore.insert(ins.mParam, mResultRegister);
+			mStoreChanged = true;
 			break;
 		case OpCode::CopyResultToPrimary:
 			mPrimaryRegister = mResultRegister;
@@ -137,7 +227,7 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 			mSecondaryRegister = mResultRegister;
 			break;
 		case OpCode::Load:
-			mResultRegister = mData.value(ins.mParam);
+			mResultRegister = mStore.value(ins.mParam);
 			break;
 		case OpCode::Equal:
 			mResultRegister = mPrimaryRegister.equal(mSecondaryRegister);
@@ -192,19 +282,23 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 			mResultRegister = mEnergy;
 			break;
 		case OpCode::Eat:
-			return new EatAction(this, mSpeed, foodTypeFromParam(ins.mParam));
+			action = Action::eat(this, mSpeed, (FoodType)ins.mParam);
+			return true;
 
 		case OpCode::Move:
-			return new MoveAction(this, mSpeed, directionFromParam(ins.mParam));
+			action = Action::move(this, mSpeed, (Direction)ins.mParam);
+			return true;
 		case OpCode::Attack:
-			return new AttackAction(this, mSpeed, directionFromParam(ins.mParam), mPower);
+			action = Action::attack(this, mSpeed, (Direction)ins.mParam, mPower);
+			return true;
 		case OpCode::Heal:
-			return new HealAction(this, mSpeed);
+			action = Action::heal(this, mSpeed);
+			return true;
 		case OpCode::ResetTargetMarker:
 			mTargetMarker = Position();
 			break;
 		case OpCode::MoveTargetMarker:
-			mTargetMarker = mTargetMarker.targetLocation(directionFromParam(ins.mParam), 1);
+			mTargetMarker = mTargetMarker.targetLocation((Direction)ins.mParam, 1);
 			break;
 		case OpCode::IsTargetMarkerOnMap:
 			if (map->isPositionOnMap(targetMarkerPosition())) {
@@ -216,7 +310,7 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 			break;
 		case OpCode::GetFoodLevel:
 			if (map->isPositionOnMap(targetMarkerPosition())) {
-				mResultRegister = map->tile(targetMarkerPosition()).mFoodLevels[(int)foodTypeFromParam(ins.mParam)];
+				mResultRegister = map->foodLevel(targetMarkerPosition(), (FoodType)ins.mParam);
 			}
 			else {
 				mResultRegister = EntityProperty::min();
@@ -248,7 +342,7 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 		case OpCode::CheckEntityHealth: {
 			Entity *entity = map->entity(targetMarkerPosition());
 			if (entity) {
-				mResultRegister = entity->health();
+				mResultRegister = entity->sensed().mHealth;
 			}
 			else {
 				mResultRegister = EntityProperty::min();
@@ -258,7 +352,7 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 		case OpCode::CheckEntitySpeed: {
 			Entity *entity = map->entity(targetMarkerPosition());
 			if (entity) {
-				mResultRegister = entity->speed();
+				mResultRegister = entity->sensed().mSpeed;
 			}
 			else {
 				mResultRegister = EntityProperty::min();
@@ -267,26 +361,20 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 		}
 		case OpCode::ConditionalJump:
 			if (!mPrimaryRegister.isMin()) {
-				int jump = ins.mParam % mByteCode.size();
-				for (int i = 0; i < jump - 1; i++) {
-					nextInstruction();
-				}
+				mExecutionPoint = ins.mJumpTarget;
 			}
 			break;
-		case OpCode::Jump: {
-			int jump = ins.mParam % mByteCode.size();
-			for (int i = 0; i < jump - 1; i++) {
-				nextInstruction();
-			}
+		case OpCode::Jump:
+			mExecutionPoint = ins.mJumpTarget;
 			break;
-		}
 		case OpCode::Reproduce:
-			return new ReproduceAction(this, mSpeed);
+			action = Action::reproduce(this, mSpeed);
+			return true;
 
 		case OpCode::LoadEntityStore: {
 			Entity *entity = map->entity(targetMarkerPosition());
 			if (entity) {
-				mResultRegister = entity->loadStore(ins.mParam);
+				mResultRegister = entity->sensed().mStore.value(ins.mParam);
 			}
 			else {
 				mResultRegister = EntityProperty::min();
@@ -296,7 +384,8 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 		case OpCode::CopyEntityStore: {
 			Entity *entity = map->entity(targetMarkerPosition());
 			if (entity) {
-				return new CommunicateAction(this, mSpeed, entity, ins.mParam, mPrimaryRegister);
+				action = Action::communicate(this, mSpeed, entity, ins.mParam, mPrimaryRegister);
+				return true;
 			}
 			else {
 				mResultRegister = EntityProperty::min();
@@ -304,7 +393,8 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 			break;
 		}
 		case OpCode::Drink: {
-			return new DrinkAction(this, mSpeed);
+			action = Action::drink(this, mSpeed);
+			return true;
 		}
 		case OpCode::CheckHydrationLevel: {
 			mResultRegister = mHydration;
@@ -312,7 +402,7 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 		}
 		case OpCode::CheckWaterLevel:
 			if (map->isPositionOnMap(targetMarkerPosition())) {
-				mResultRegister = map->tile(targetMarkerPosition()).mWaterLevel;
+				mResultRegister = map->waterLevel(targetMarkerPosition());
 			}
 			else {
 				mResultRegister = EntityProperty::min();
@@ -320,16 +410,254 @@ Action* Entity::execInstruction(const Map *map, const Instruction &ins) {
 			break;
 		case OpCode::CheckHeatLevel:
 			if (map->isPositionOnMap(targetMarkerPosition())) {
-				mResultRegister = map->tile(targetMarkerPosition()).mHeat;
+				mResultRegister = map->heat(targetMarkerPosition());
 			}
 			else {
 				mResultRegister = EntityProperty::min();
 			}
 			break;
+		case OpCode::SetTargetMarker: {
+			// ResetTargetMarker, MoveTargetMarker
+			const ProgramInstruction *seq = &ins;
+			mTargetMarker = Position().targetLocation((Direction)seq[1].mParam, 1);
+			mExecutionPoint = seq[1].mNext;
+			break;
+		}
+		case OpCode::PrimaryJump: {
+			// CopyResultToPrimary, ConditionalJump
+			const ProgramInstruction *seq = &ins;
+			mPrimaryRegister = mResultRegister;
+			mExecutionPoint = mPrimaryRegister.isMin() ? seq[1].mNext : seq[1].mJumpTarget;
+			break;
+		}
+		case OpCode::GreaterJump: {
+			// Greater, ConditionalJump
+			const ProgramInstruction *seq = &ins;
+			mResultRegister = mPrimaryRegister > mSecondaryRegister ? EntityProperty::max() : EntityProperty::min();
+			mExecutionPoint = mPrimaryRegister.isMin() ? seq[1].mNext : seq[1].mJumpTarget;
+			break;
+		}
+		case OpCode::ContainsEntityJump: {
+			// ContainsEntity, CopyResultToPrimary, ConditionalJump
+			const ProgramInstruction *seq = &ins;
+			mResultRegister = map->entity(targetMarkerPosition()) ? EntityProperty::max() : EntityProperty::min();
+			mPrimaryRegister = mResultRegister;
+			mExecutionPoint = mPrimaryRegister.isMin() ? seq[2].mNext : seq[2].mJumpTarget;
+			break;
+		}
+		case OpCode::SenseEntityJump: {
+			// ResetTargetMarker, MoveTargetMarker, ContainsEntity, CopyResultToPrimary, ConditionalJump
+			const ProgramInstruction *seq = &ins;
+			mTargetMarker = Position().targetLocation((Direction)seq[1].mParam, 1);
+			mResultRegister = map->entity(targetMarkerPosition()) ? EntityProperty::max() : EntityProperty::min();
+			mPrimaryRegister = mResultRegister;
+			mExecutionPoint = mPrimaryRegister.isMin() ? seq[4].mNext : seq[4].mJumpTarget;
+			break;
+		}
+		case OpCode::CompareEnergyJump: {
+			// LiteralPrimary, GetEnergy, CopyResultToSecondary, Greater, ConditionalJump
+			const ProgramInstruction *seq = &ins;
+			mPrimaryRegister = seq[0].mParam;
+			mSecondaryRegister = mEnergy;
+			mResultRegister = mPrimaryRegister > mSecondaryRegister ? EntityProperty::max() : EntityProperty::min();
+			mExecutionPoint = mPrimaryRegister.isMin() ? seq[4].mNext : seq[4].mJumpTarget;
+			break;
+		}
 		case OpCode::MaxOpCode:
+		case OpCode::MaxInternalOpCode:
 			assert("Max op code" && 0);
 	}
-	return 0;
+	return false;
+}
+
+#ifdef SWITCH_INTERPRETER
+bool Entity::execInstruction(const Map *map, const ProgramInstruction &ins, Action &action) {
+	switch (ins.mOpCode) {
+		case OpCode::Literal:
+			return execOp<OpCode::Literal>(map, ins, action);
+		case OpCode::LiteralPrimary:
+			return execOp<OpCode::LiteralPrimary>(map, ins, action);
+		case OpCode::LiteralSecondary:
+			return execOp<OpCode::LiteralSecondary>(map, ins, action);
+		case OpCode::Copy:
+			return execOp<OpCode::Copy>(map, ins, action);
+		case OpCode::CopyResultToPrimary:
+			return execOp<OpCode::CopyResultToPrimary>(map, ins, action);
+		case OpCode::CopyResultToSecondary:
+			return execOp<OpCode::CopyResultToSecondary>(map, ins, action);
+		case OpCode::Load:
+			return execOp<OpCode::Load>(map, ins, action);
+		case OpCode::Equal:
+			return execOp<OpCode::Equal>(map, ins, action);
+		case OpCode::Greater:
+			return execOp<OpCode::Greater>(map, ins, action);
+		case OpCode::Add:
+			return execOp<OpCode::Add>(map, ins, action);
+		case OpCode::Substract:
+			return execOp<OpCode::Substract>(map, ins, action);
+		case OpCode::And:
+			return execOp<OpCode::And>(map, ins, action);
+		case OpCode::Or:
+			return execOp<OpCode::Or>(map, ins, action);
+		case OpCode::Not:
+			return execOp<OpCode::Not>(map, ins, action);
+		case OpCode::True:
+			return execOp<OpCode::True>(map, ins, action);
+		case OpCode::SetSpeed:
+			return execOp<OpCode::SetSpeed>(map, ins, action);
+		case OpCode::SetPower:
+			return execOp<OpCode::SetPower>(map, ins, action);
+		case OpCode::GetSpeed:
+			return execOp<OpCode::GetSpeed>(map, ins, action);
+		case OpCode::GetPower:
+			return execOp<OpCode::GetPower>(map, ins, action);
+		case OpCode::GetHealt:
+			return execOp<OpCode::GetHealt>(map, ins, action);
+		case OpCode::GetMaxHealt:
+			return execOp<OpCode::GetMaxHealt>(map, ins, action);
+		case OpCode::GetEnergy:
+			return execOp<OpCode::GetEnergy>(map, ins, action);
+		case OpCode::Eat:
+			return execOp<OpCode::Eat>(map, ins, action);
+		case OpCode::Move:
+			return execOp<OpCode::Move>(map, ins, action);
+		case OpCode::Attack:
+			return execOp<OpCode::Attack>(map, ins, action);
+		case OpCode::Heal:
+			return execOp<OpCode::Heal>(map, ins, action);
+		case OpCode::ResetTargetMarker:
+			return execOp<OpCode::ResetTargetMarker>(map, ins, action);
+		case OpCode::MoveTargetMarker:
+			return execOp<OpCode::MoveTargetMarker>(map, ins, action);
+		case OpCode::IsTargetMarkerOnMap:
+			return execOp<OpCode::IsTargetMarkerOnMap>(map, ins, action);
+		case OpCode::GetFoodLevel:
+			return execOp<OpCode::GetFoodLevel>(map, ins, action);
+		case OpCode::ContainsEntity:
+			return execOp<OpCode::ContainsEntity>(map, ins, action);
+		case OpCode::EntityCheckSum:
+			return execOp<OpCode::EntityCheckSum>(map, ins, action);
+		case OpCode::SelfCheckSum:
+			return execOp<OpCode::SelfCheckSum>(map, ins, action);
+		case OpCode::CheckEntityHealth:
+			return execOp<OpCode::CheckEntityHealth>(map, ins, action);
+		case OpCode::CheckEntitySpeed:
+			return execOp<OpCode::CheckEntitySpeed>(map, ins, action);
+		case OpCode::ConditionalJump:
+			return execOp<OpCode::ConditionalJump>(map, ins, action);
+		case OpCode::Jump:
+			return execOp<OpCode::Jump>(map, ins, action);
+		case OpCode::Reproduce:
+			return execOp<OpCode::Reproduce>(map, ins, action);
+		case OpCode::LoadEntityStore:
+			return execOp<OpCode::LoadEntityStore>(map, ins, action);
+		case OpCode::CopyEntityStore:
+			return execOp<OpCode::CopyEntityStore>(map, ins, action);
+		case OpCode::Drink:
+			return execOp<OpCode::Drink>(map, ins, action);
+		case OpCode::CheckHydrationLevel:
+			return execOp<OpCode::CheckHydrationLevel>(map, ins, action);
+		case OpCode::CheckWaterLevel:
+			return execOp<OpCode::CheckWaterLevel>(map, ins, action);
+		case OpCode::CheckHeatLevel:
+			return execOp<OpCode::CheckHeatLevel>(map, ins, action);
+		default:
+			return execOp<OpCode::MaxOpCode>(map, ins, action);
+	}
+}
+
+void Entity::execSuperInstruction(const Map *map, const ProgramInstruction &ins, Action &action) {
+	switch (ins.mFusedOpCode) {
+		case OpCode::SetTargetMarker:
+			execOp<OpCode::SetTargetMarker>(map, ins, action);
+			break;
+		case OpCode::PrimaryJump:
+			execOp<OpCode::PrimaryJump>(map, ins, action);
+			break;
+		case OpCode::GreaterJump:
+			execOp<OpCode::GreaterJump>(map, ins, action);
+			break;
+		case OpCode::ContainsEntityJump:
+			execOp<OpCode::ContainsEntityJump>(map, ins, action);
+			break;
+		case OpCode::SenseEntityJump:
+			execOp<OpCode::SenseEntityJump>(map, ins, action);
+			break;
+		case OpCode::CompareEnergyJump:
+			execOp<OpCode::CompareEnergyJump>(map, ins, action);
+			break;
+		default:
+			execOp<OpCode::MaxInternalOpCode>(map, ins, action);
+			break;
+	}
+}
+#else
+template <OpCode Code>
+bool Entity::threadedHandler(Entity *entity, const Map *map, const ProgramInstruction &ins, Action &action) {
+	return entity->execOp<Code>(map, ins, action);
+}
+#endif
+
+Program Entity::compileProgram(const QVector<Instruction> &byteCode) {
+#ifdef SWITCH_INTERPRETER
+	return Program::compile(byteCode);
+#else
+	static const InstructionHandler handlers[] = {
+		&Entity::threadedHandler<OpCode::Literal>,
+		&Entity::threadedHandler<OpCode::LiteralPrimary>,
+		&Entity::threadedHandler<OpCode::LiteralSecondary>,
+		&Entity::threadedHandler<OpCode::Copy>,
+		&Entity::threadedHandler<OpCode::CopyResultToPrimary>,
+		&Entity::threadedHandler<OpCode::CopyResultToSecondary>,
+		&Entity::threadedHandler<OpCode::Load>,
+		&Entity::threadedHandler<OpCode::Equal>,
+		&Entity::threadedHandler<OpCode::Greater>,
+		&Entity::threadedHandler<OpCode::Add>,
+		&Entity::threadedHandler<OpCode::Substract>,
+		&Entity::threadedHandler<OpCode::And>,
+		&Entity::threadedHandler<OpCode::Or>,
+		&Entity::threadedHandler<OpCode::Not>,
+		&Entity::threadedHandler<OpCode::True>,
+		&Entity::threadedHandler<OpCode::SetSpeed>,
+		&Entity::threadedHandler<OpCode::SetPower>,
+		&Entity::threadedHandler<OpCode::GetSpeed>,
+		&Entity::threadedHandler<OpCode::GetPower>,
+		&Entity::threadedHandler<OpCode::GetHealt>,
+		&Entity::threadedHandler<OpCode::GetMaxHealt>,
+		&Entity::threadedHandler<OpCode::GetEnergy>,
+		&Entity::threadedHandler<OpCode::Eat>,
+		&Entity::threadedHandler<OpCode::Move>,
+		&Entity::threadedHandler<OpCode::Attack>,
+		&Entity::threadedHandler<OpCode::Heal>,
+		&Entity::threadedHandler<OpCode::ResetTargetMarker>,
+		&Entity::threadedHandler<OpCode::MoveTargetMarker>,
+		&Entity::threadedHandler<OpCode::IsTargetMarkerOnMap>,
+		&Entity::threadedHandler<OpCode::GetFoodLevel>,
+		&Entity::threadedHandler<OpCode::ContainsEntity>,
+		&Entity::threadedHandler<OpCode::EntityCheckSum>,
+		&Entity::threadedHandler<OpCode::SelfCheckSum>,
+		&Entity::threadedHandler<OpCode::CheckEntityHealth>,
+		&Entity::threadedHandler<OpCode::CheckEntitySpeed>,
+		&Entity::threadedHandler<OpCode::ConditionalJump>,
+		&Entity::threadedHandler<OpCode::Jump>,
+		&Entity::threadedHandler<OpCode::Reproduce>,
+		&Entity::threadedHandler<OpCode::LoadEntityStore>,
+		&Entity::threadedHandler<OpCode::CopyEntityStore>,
+		&Entity::threadedHandler<OpCode::Drink>,
+		&Entity::threadedHandler<OpCode::CheckHydrationLevel>,
+		&Entity::threadedHandler<OpCode::CheckWaterLevel>,
+		&Entity::threadedHandler<OpCode::CheckHeatLevel>,
+		&Entity::threadedHandler<OpCode::MaxOpCode>,
+		&Entity::threadedHandler<OpCode::SetTargetMarker>,
+		&Entity::threadedHandler<OpCode::PrimaryJump>,
+		&Entity::threadedHandler<OpCode::GreaterJump>,
+		&Entity::threadedHandler<OpCode::ContainsEntityJump>,
+		&Entity::threadedHandler<OpCode::SenseEntityJump>,
+		&Entity::threadedHandler<OpCode::CompareEnergyJump>,
+		&Entity::threadedHandler<OpCode::MaxInternalOpCode>,
+	};
+	return Program::compile(byteCode, handlers);
+#endif
 }
 
 Direction Entity::directionFromParam(EntityProperty::ValueType param) {
@@ -352,16 +680,21 @@ FoodType Entity::foodTypeFromParam(EntityProperty::ValueType param) {
 	return FoodType::V;
 }
 EntityProperty Entity::foodLevelAdaption() const {
-	return mFoodLevelAdaption;
+	return cold().mFoodLevelAdaption;
 }
 
 void Entity::setFoodLevelAdaption(const EntityProperty &foodLevelAdaption) {
-	mFoodLevelAdaption = foodLevelAdaption;
+	cold().mFoodLevelAdaption = foodLevelAdaption;
 }
 
-EntityProperty Entity::drinkEnergyCost(EntityProperty speed) {
+EntityProperty Entity::drinkEnergyCost(const Map *map, EntityProperty speed) {
 	std::uniform_int_distribution<> dist(0, (int)hydrationAdaption().value() * 10);
-	return speed / 2 + 1 + dist(mRandomizer) / 50;
+	RandomStream random = randomStream(map, DrinkRandom);
+	return speed / 2 + 1 + dist(random) / 50;
+}
+
+RandomStream Entity::randomStream(const Map *map, RandomUse use) const {
+	return RandomStream(RandomStream::key(map->seed(), mId, map->tick(), use));
 }
 
 bool Entity::isInBornState() const {
@@ -383,11 +716,11 @@ quint64 Entity::lifeTime() const {
 }
 
 quint64 Entity::generation() const {
-	return mGeneration;
+	return cold().mGeneration;
 }
 
 void Entity::setGeneration(quint64 gen) {
-	mGeneration = gen;
+	cold().mGeneration = gen;
 }
 
 void Entity::save(QDataStream &stream, int format) const {
@@ -402,16 +735,17 @@ void Entity::save(QDataStream &stream, int format) const {
 	stream << mPrimaryRegister;
 	stream << mSecondaryRegister;
 	stream << mLifeTime;
-	stream << mData;
-	stream << mByteCode;
+	stream << mStore;
+	stream << mGenome->byteCode();
 	stream << mExecutionPoint;
-	stream << mGeneration;
+	stream << cold().mGeneration;
 	stream << mHydrationAdaption;
-	stream << mFoodLevelAdaption;
-	stream << mBornState;
+	stream << cold().mFoodLevelAdaption;
+	stream << (qint32)mBornState;
+	if (format >= 2) stream << mId;
 }
 
-void Entity::load(QDataStream &stream, int format) {
+void Entity::load(QDataStream &stream, int format, GenomePool &genomePool) {
 	stream >> mHealth;
 	stream >> mMaxHealth;
 	stream >> mEnergy;
@@ -423,29 +757,44 @@ void Entity::load(QDataStream &stream, int format) {
 	stream >> mPrimaryRegister;
 	stream >> mSecondaryRegister;
 	stream >> mLifeTime;
-	stream >> mData;
-	stream >> mByteCode;
+	stream >> mStore;
+	QVector<Instruction> byteCode;
+	stream >> byteCode;
+	mGenome = genomePool.intern(byteCode);
 	stream >> mExecutionPoint;
-	stream >> mGeneration;
+	stream >> cold().mGeneration;
 	stream >> mHydrationAdaption;
-	stream >> mFoodLevelAdaption;
-	stream >> mBornState;
+	stream >> cold().mFoodLevelAdaption;
+	qint32 bornState;
+	stream >> bornState;
+	mBornState = bornState;
+	if (format >= 2) stream >> mId;
+	mStoreChanged = true;
 }
 
 EntityProperty Entity::loadStore(EntityProperty::ValueType id) const {
-	return mData.value(id);
+	return mStore.value(id);
 }
 
 void Entity::saveStore(EntityProperty::ValueType id, const EntityProperty &val) {
-	mData[id] = val;
+	mStore.insert(id, val);
+	mStoreChanged = true;
+}
+
+const EntityStore &Entity::store() const {
+	return mStore;
 }
 
 const QVector<Instruction> &Entity::byteCode() const {
-	return mByteCode;
+	return mGenome->byteCode();
 }
 
-void Entity::setByteCode(const QVector<Instruction> &byteCode) {
-	mByteCode = byteCode;
+const GenomeHandle &Entity::genome() const {
+	return mGenome;
+}
+
+void Entity::setGenome(const GenomeHandle &genome) {
+	mGenome = genome;
 	mExecutionPoint = 0;
 }
 
@@ -466,7 +815,7 @@ bool Entity::deletePass() {
 
 QString Entity::byteCodeAsString() const {
 	QString text;
-	for (const Instruction &ins : mByteCode) {
+	for (const Instruction &ins : mGenome->byteCode()) {
 		switch (ins.mOpCode) {
 			case OpCode::Literal:
 				text += "Literal: " + QString::number(ins.mParam);
@@ -615,18 +964,3 @@ QString Entity::byteCodeAsString() const {
 	}
 	return text;
 }
-
-
-QDataStream &operator <<(QDataStream &out, const Instruction &ins) {
-	out << (int)ins.mOpCode;
-	out << ins.mParam;
-	return out;
-}
-
-
-QDataStream &operator >>(QDataStream &in, Instruction &ins) {
-	int opCode;
-	in >> opCode >> ins.mParam;
-	ins.mOpCode = (OpCode)opCode;
-	return in;
-}
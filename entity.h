@@ -4,88 +4,65 @@
 #include "entityproperty.h"
 #include "position.h"
 #include "enums.h"
-#include <QHash>
+#include "instruction.h"
+#include "genomepool.h"
+#include "entitystore.h"
 #include <QVector>
 #include <QMap>
-#include <random>
+#include "randomstream.h"
+#include "entityhandle.h"
 
 class Action;
 class Map;
 
-enum class OpCode : quint8 {
-	Literal,
-	LiteralPrimary,
-	LiteralSecondary,
-	Copy,
-	CopyResultToPrimary,
-	CopyResultToSecondary,
-	Load,
-	Equal,
-	Greater,
-	Add,
-	Substract,
-	And,
-	Or,
-	Not,
-	True,
-	SetSpeed,
-	SetPower,
-	GetSpeed,
-	GetPower,
-	GetHealt,
-	GetMaxHealt,
-	GetEnergy,
-	Eat,
-	Move,
-	Attack,
-	Heal,
-	ResetTargetMarker,
-	MoveTargetMarker,
-	IsTargetMarkerOnMap,
-	GetFoodLevel,
-	ContainsEntity,
-
-	EntityCheckSum,
-	SelfCheckSum,
-
-	CheckEntityHealth,
-	CheckEntitySpeed,
-
-	ConditionalJump,
-	Jump,
-
-	Reproduce,
-
-	LoadEntityStore,
-	CopyEntityStore,
-
-	Drink,
-
-	CheckHydrationLevel,
-	CheckWaterLevel,
-	CheckHeatLevel,
-
-
-	MaxOpCode
-};
+// Fields of an entity that are rarely touched, by Eat, reproduction, the statistics and
+// saving. The EntityPool keeps them in an array of their own next to the entities.
+struct EntityColdData {
+	EntityColdData();
 
-struct Instruction {
-	Instruction() : mOpCode(OpCode::MaxOpCode), mParam(0) {}
-	Instruction(OpCode code, EntityProperty::ValueType param) : mOpCode(code), mParam(param) {}
-	OpCode mOpCode;
-	EntityProperty::ValueType mParam;
+	quint64 mGeneration;
+	EntityProperty mFoodLevelAdaption;
 };
 
+// What the programs of other entities sense of an entity: its state once beginUpdate ran,
+// before its own program changed anything. Programs of a tick run concurrently, so
+// CheckEntityHealth, CheckEntitySpeed and LoadEntityStore read this copy instead of the
+// live fields. The EntityPool keeps it in an array of its own next to the entities.
+struct EntitySensedState {
+	EntityProperty mHealth;
+	EntityProperty mSpeed;
+	EntityStore mStore;
+};
 
-class Entity {
+// Entities are only created and destroyed by an EntityPool, which also keeps their cold
+// data. Every entity starts at a cache line.
+class alignas(64) Entity {
 	public:
-		Entity();
-		~Entity();
+		// What an entity draws random numbers for, each use has a stream of its own
+		enum RandomUse {
+			HydrationRandom,
+			DrinkRandom,
+			ChildRandom
+		};
+
+		// Unique in a map, assigned when the entity is added to it
+		quint64 id() const;
+		void setId(quint64 id);
+		// Handle of the entity in the pool it was created in
+		EntityHandle handle() const;
 
 		Position position() const;
 		void setPosition(const Position &position);
 
-		Action *update(const Map *map);
+		// A tick of an entity. beginUpdate ages the entity and publishes its sensed state.
+		// It has to run for every entity before any of them runs exec, and returns false
+		// if the entity doesn't run its program this tick. exec returns true if the
+		// entity chose an action, which is stored in action.
+		bool beginUpdate(const Map *map);
+		bool exec(const Map *map, const int maxInstruction, int &instructionCounter, Action &action);
+		void endUpdate(int instructionCounter);
+
+		static const int maxInstructions = 1000;
 
 		EntityProperty &health();
 		EntityProperty &energy();
@@ -96,12 +73,16 @@ class Entity {
 
 		void reportActionResult(EntityProperty success);
 
-		EntityProperty byteCodeCheckSum();
+		EntityProperty byteCodeCheckSum() const;
 
 		const QVector<Instruction> &byteCode() const;
-		void setByteCode(const QVector<Instruction> &byteCode);
+		const GenomeHandle &genome() const;
+		void setGenome(const GenomeHandle &genome);
 
+		// Drains health if the entity has no energy left. Returns true if it died.
 		bool deletePass();
+		// True once deletePass returned true
+		bool isDead() const;
 
 
 		QString byteCodeAsString() const;
@@ -113,11 +94,12 @@ class Entity {
 
 		void save(QDataStream &stream, int format) const;
 
-		void load(QDataStream &stream, int format);
+		void load(QDataStream &stream, int format, GenomePool &genomePool);
 
 
 		EntityProperty loadStore(EntityProperty::ValueType id) const;
 		void saveStore(EntityProperty::ValueType id, const EntityProperty &val);
+		const EntityStore &store() const;
 		EntityProperty hydrationAdaption() const;
 		void setHydrationAdaption(const EntityProperty &hydrationAdaption);
 
@@ -125,63 +107,116 @@ class Entity {
 		void setFoodLevelAdaption(const EntityProperty &foodLevelAdaption);
 
 
-		EntityProperty drinkEnergyCost(EntityProperty speed);
+		EntityProperty drinkEnergyCost(const Map *map, EntityProperty speed);
+		// Random numbers of this entity for one use in the current tick. They only
+		// depend on the map's seed, the id and the tick.
+		RandomStream randomStream(const Map *map, RandomUse use) const;
 		bool isInBornState() const;
-	private:
-		const Instruction &instruction() const;
-		void nextInstruction();
-		Action *exec(const Map *map, const int maxInstruction, int &instructionCounter);
-		Action *execInstruction(const Map *map, const Instruction &ins);
+
 		static Direction directionFromParam(EntityProperty::ValueType param);
 		static FoodType foodTypeFromParam(EntityProperty::ValueType param);
+		static Program compileProgram(const QVector<Instruction> &byteCode);
+	private:
+		friend class BatchInterpreter;
+		friend class DecisionMemo;
+		friend class EntityPool;
+
+		Entity();
+		~Entity();
+
+		bool execStep(const Map *map, const int maxInstruction, int &instructionCounter, Action &action);
+		bool execNext(const Map *map, Action &action);
+		void execFused(const Map *map, const ProgramInstruction &ins, Action &action);
+		template <OpCode Code>
+		bool execOp(const Map *map, const ProgramInstruction &ins, Action &action);
+#ifdef SWITCH_INTERPRETER
+		bool execInstruction(const Map *map, const ProgramInstruction &ins, Action &action);
+		void execSuperInstruction(const Map *map, const ProgramInstruction &ins, Action &action);
+#else
+		template <OpCode Code>
+		static bool threadedHandler(Entity *entity, const Map *map, const ProgramInstruction &ins, Action &action);
+#endif
+#ifdef ENABLE_JIT
+		bool execNative(const Map *map, const JitCode *code, const int maxInstruction, int &instructionCounter, Action &action);
+		void toJitState(JitState &state) const;
+		void fromJitState(const JitState &state);
+#endif
 		Position targetMarkerPosition() const;
+		void updateHydration(const Map *map);
 
+		EntityColdData &cold();
+		const EntityColdData &cold() const;
+		EntitySensedState &sensed();
+		const EntitySensedState &sensed() const;
+
+		// Ordered so that the fields beginUpdate, endUpdate and programs without store
+		// instructions read and write fill exactly the first cache line. The store is
+		// only copied to the sensed state in the ticks after it changed.
+		Position mPosition;
+		Position mTargetMarker;
+		EntityProperty mResultRegister;
+		EntityProperty mPrimaryRegister;
+		EntityProperty mSecondaryRegister;
 		EntityProperty mHealth;
 		EntityProperty mMaxHealth;
 		EntityProperty mEnergy;
 		EntityProperty mMaxEnergy;
 		EntityProperty mSpeed;
 		EntityProperty mPower;
-		Position mPosition;
-		Position mTargetMarker;
-		EntityProperty mResultRegister;
-		EntityProperty mPrimaryRegister;
-		EntityProperty mSecondaryRegister;
 		EntityProperty mHydration;
-		quint64 mLifeTime;
-
-
 		EntityProperty mHydrationAdaption;
-		EntityProperty mFoodLevelAdaption;
-
-		int mBornState;
-
-		QHash<EntityProperty::ValueType, EntityProperty> mData;
-
-		QVector<Instruction> mByteCode;
+		// Counts up from -20 to 0
+		qint8 mBornState;
+		// mStore changed since beginUpdate last published it
+		bool mStoreChanged;
 		int mExecutionPoint;
-
-		quint64 mGeneration;
 		int mExecutionEnergyUsageCounter;
+		GenomeHandle mGenome;
+		quint64 mLifeTime;
 
-		std::mt19937 mRandomizer;
+		EntityHandle mHandle;
+		quint64 mId;
+		EntityStore mStore;
 };
 
-inline const Instruction &Entity::instruction() const {
-	return mByteCode[mExecutionPoint];
+inline bool Entity::execNext(const Map *map, Action &action) {
+	const ProgramInstruction &ins = mGenome->program().instruction(mExecutionPoint);
+	mExecutionPoint = ins.mNext;
+#ifdef SWITCH_INTERPRETER
+	return execInstruction(map, ins, action);
+#else
+	return ins.mHandler(this, map, ins, action);
+#endif
 }
 
-inline void Entity::nextInstruction() {
-	++mExecutionPoint;
-	if (mExecutionPoint == mByteCode.size()) {
-		mExecutionPoint = 0;
+inline bool Entity::execStep(const Map *map, const int maxInstruction, int &instructionCounter, Action &action) {
+	const ProgramInstruction &ins = mGenome->program().instruction(mExecutionPoint);
+	// Superinstructions never produce an action, but they are only used if the whole
+	// sequence fits into the instruction budget so the counter stays exact.
+	if (ins.mFusedLength > 1 && instructionCounter + ins.mFusedLength <= maxInstruction) {
+		execFused(map, ins, action);
+		instructionCounter += ins.mFusedLength;
+		return false;
 	}
+	if (execNext(map, action)) return true;
+	instructionCounter++;
+	return false;
+}
+
+inline void Entity::execFused(const Map *map, const ProgramInstruction &ins, Action &action) {
+#ifdef SWITCH_INTERPRETER
+	execSuperInstruction(map, ins, action);
+#else
+	ins.mFusedHandler(this, map, ins, action);
+#endif
+}
+
+inline bool Entity::isDead() const {
+	return mHealth == EntityProperty::min();
 }
 
 inline Position Entity::targetMarkerPosition() const {
 	return mPosition + mTargetMarker;
 }
 
-QDataStream &operator << (QDataStream &out, const Instruction &ins);
-QDataStream &operator >> (QDataStream &in, Instruction &ins);
 #endif // ENTITY_H
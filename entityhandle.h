@@ -0,0 +1,59 @@
+#ifndef ENTITYHANDLE_H
+#define ENTITYHANDLE_H
+#include <QtGlobal>
+
+// 32 bit reference to an entity in an EntityPool: the index of its slot and the
+// generation the slot had when the entity was created. Slots are reused, and every
+// reuse changes the generation, so a handle kept after its entity was destroyed no
+// longer resolves. Generations of live entities are odd, the null handle is all zero.
+class EntityHandle {
+	public:
+		static const int IndexBits = 24;
+		static const int GenerationBits = 8;
+		static const quint32 IndexMask = (1u << IndexBits) - 1;
+		static const quint32 GenerationMask = (1u << GenerationBits) - 1;
+
+		EntityHandle();
+		EntityHandle(quint32 index, quint32 generation);
+
+		bool isNull() const;
+		quint32 index() const;
+		quint32 generation() const;
+
+		bool operator==(const EntityHandle &other) const;
+		bool operator!=(const EntityHandle &other) const;
+	private:
+		quint32 mValue;
+};
+
+inline EntityHandle::EntityHandle() :
+	mValue(0) {
+
+}
+
+inline EntityHandle::EntityHandle(quint32 index, quint32 generation) :
+	mValue(generation << IndexBits | index) {
+
+}
+
+inline bool EntityHandle::isNull() const {
+	return mValue == 0;
+}
+
+inline quint32 EntityHandle::index() const {
+	return mValue & IndexMask;
+}
+
+inline quint32 EntityHandle::generation() const {
+	return mValue >> IndexBits;
+}
+
+inline bool EntityHandle::operator==(const EntityHandle &other) const {
+	return mValue == other.mValue;
+}
+
+inline bool EntityHandle::operator!=(const EntityHandle &other) const {
+	return mValue != other.mValue;
+}
+
+#endif // ENTITYHANDLE_H
@@ -0,0 +1,58 @@
+#include "entitypool.h"
+#include <QMutexLocker>
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+EntityPool::EntityPool() :
+	mChunkCount(0),
+	mFirstFreeMask(0) {
+	std::fill(mChunks, mChunks + MaxChunks, (Chunk*)0);
+}
+
+EntityPool::~EntityPool() {
+	for (int c = 0; c < mChunkCount; c++) {
+		Chunk *chunk = mChunks[c];
+		for (int i = 0; i < ChunkSize; i++) {
+			if (chunk->mGenerations[i] & 1) slot(chunk, i)->~Entity();
+		}
+		qFreeAligned(chunk);
+	}
+}
+
+Entity *EntityPool::create() {
+	QMutexLocker locker(&mMutex);
+	while (mFirstFreeMask < mFreeMasks.size() && !mFreeMasks[mFirstFreeMask]) mFirstFreeMask++;
+	if (mFirstFreeMask == mFreeMasks.size()) addChunk();
+	quint64 &freeMask = mFreeMasks[mFirstFreeMask];
+	const quint32 index = mFirstFreeMask * 64 + qCountTrailingZeroBits(freeMask);
+	freeMask &= freeMask - 1;
+	Chunk *chunk = mChunks[index >> ChunkBits];
+	quint8 &generation = chunk->mGenerations[index & (ChunkSize - 1)];
+	generation = (generation + 1) & EntityHandle::GenerationMask;
+	new (&chunk->mColdSlots[index & (ChunkSize - 1)]) EntityColdData();
+	new (&chunk->mSensedSlots[index & (ChunkSize - 1)]) EntitySensedState();
+	Entity *entity = new (slot(chunk, index & (ChunkSize - 1))) Entity();
+	entity->mHandle = EntityHandle(index, generation);
+	return entity;
+}
+
+void EntityPool::destroy(Entity *entity) {
+	const quint32 index = entity->handle().index();
+	entity->~Entity();
+	QMutexLocker locker(&mMutex);
+	quint8 &generation = mChunks[index >> ChunkBits]->mGenerations[index & (ChunkSize - 1)];
+	generation = (generation + 1) & EntityHandle::GenerationMask;
+	mFreeMasks[index / 64] |= 1ull << (index % 64);
+	mFirstFreeMask = qMin(mFirstFreeMask, (int)index / 64);
+}
+
+void EntityPool::addChunk() {
+	assert("Too many entities for the handle's index bits" && mChunkCount < MaxChunks);
+	// new doesn't align to more than 16 bytes before C++17
+	Chunk *chunk = static_cast<Chunk*>(qMallocAligned(sizeof(Chunk), alignof(Chunk)));
+	std::fill(chunk->mGenerations, chunk->mGenerations + ChunkSize, 0);
+	mChunks[mChunkCount] = chunk;
+	for (int i = 0; i < ChunkSize / 64; i++) mFreeMasks.append(~0ull);
+	mChunkCount++;
+}
@@ -0,0 +1,88 @@
+#ifndef ENTITYPOOL_H
+#define ENTITYPOOL_H
+#include <QMutex>
+#include <QVector>
+#include <type_traits>
+#include "entity.h"
+#include "entityhandle.h"
+
+// Slab allocator for the entities of a map. Entities live in chunks of ChunkSize slots
+// that are never freed or moved while the pool exists. create always takes the lowest
+// free slot, so the entities stay packed at the front of the pool and births and deaths
+// don't touch the general purpose heap once the population stopped growing. Which slot
+// an entity gets only depends on which slots are in use, not on the order they were
+// freed in.
+// The cold data and the sensed state of the entities are kept in separate arrays of the
+// chunk, with the same slot index, so walking the entities only pulls their hot fields
+// into the cache.
+//
+// create and destroy are thread safe. get can run concurrently with them, as long as
+// the handle doesn't refer to the slot being created or destroyed.
+class EntityPool {
+	public:
+		static const int ChunkBits = 12;
+		static const int ChunkSize = 1 << ChunkBits;
+		static const int MaxChunks = (1 << EntityHandle::IndexBits) / ChunkSize;
+
+		EntityPool();
+		// Destroys the entities still alive
+		~EntityPool();
+
+		// Default constructed entity with its handle set
+		Entity *create();
+		void destroy(Entity *entity);
+
+		// 0 if the handle is null or its entity was destroyed
+		Entity *get(EntityHandle handle) const;
+		static EntityColdData &cold(Entity *entity);
+		static EntitySensedState &sensed(Entity *entity);
+	private:
+		Q_DISABLE_COPY(EntityPool)
+
+		struct Chunk {
+			// First, so a slot's address minus its index is the chunk's address
+			std::aligned_storage<sizeof(Entity), alignof(Entity)>::type mSlots[ChunkSize];
+			std::aligned_storage<sizeof(EntityColdData), alignof(EntityColdData)>::type mColdSlots[ChunkSize];
+			std::aligned_storage<sizeof(EntitySensedState), alignof(EntitySensedState)>::type mSensedSlots[ChunkSize];
+			// Odd while the slot holds an entity
+			quint8 mGenerations[ChunkSize];
+		};
+
+		void addChunk();
+		static Entity *slot(Chunk *chunk, int index);
+
+		// Fixed size, so get never reads a table that is being reallocated
+		Chunk *mChunks[MaxChunks];
+		int mChunkCount;
+		// One bit per slot, set while the slot is free
+		QVector<quint64> mFreeMasks;
+		// Every mask before this one is all zero
+		int mFirstFreeMask;
+		QMutex mMutex;
+};
+
+inline Entity *EntityPool::slot(Chunk *chunk, int index) {
+	return reinterpret_cast<Entity*>(&chunk->mSlots[index]);
+}
+
+inline EntityColdData &EntityPool::cold(Entity *entity) {
+	const int index = entity->handle().index() & (ChunkSize - 1);
+	Chunk *chunk = reinterpret_cast<Chunk*>(entity - index);
+	return *reinterpret_cast<EntityColdData*>(&chunk->mColdSlots[index]);
+}
+
+inline EntitySensedState &EntityPool::sensed(Entity *entity) {
+	const int index = entity->handle().index() & (ChunkSize - 1);
+	Chunk *chunk = reinterpret_cast<Chunk*>(entity - index);
+	return *reinterpret_cast<EntitySensedState*>(&chunk->mSensedSlots[index]);
+}
+
+inline Entity *EntityPool::get(EntityHandle handle) const {
+	if (handle.isNull()) return 0;
+	Chunk *chunk = mChunks[handle.index() >> ChunkBits];
+	const int index = handle.index() & (ChunkSize - 1);
+	if (chunk->mGenerations[index] != handle.generation()) return 0;
+	return slot(chunk, index);
+}
+
+#endif // ENTITYPOOL_H
@@ -0,0 +1,37 @@
+#include "entitystore.h"
+#include <QDataStream>
+
+// Same layout as QDataStream's QHash<quint16, EntityProperty>, so older saves load as is.
+// Entries are written in ascending id order.
+QDataStream &operator << (QDataStream &out, const EntityStore &store) {
+	int order[EntityStore::Capacity];
+	int count = 0;
+	for (int slot = 0; slot < EntityStore::Capacity; slot++) {
+		if (!(store.mUsedSlots & (1 << slot))) continue;
+		int i = count++;
+		while (i > 0 && store.mKeys[order[i - 1]] > store.mKeys[slot]) {
+			order[i] = order[i - 1];
+			i--;
+		}
+		order[i] = slot;
+	}
+
+	out << (quint32)count;
+	for (int i = 0; i < count; i++) {
+		out << store.mKeys[order[i]] << store.mValues[order[i]];
+	}
+	return out;
+}
+
+QDataStream &operator >> (QDataStream &in, EntityStore &store) {
+	store.clear();
+	quint32 count;
+	in >> count;
+	for (quint32 i = 0; i < count; i++) {
+		EntityProperty::ValueType id;
+		EntityProperty value;
+		in >> id >> value;
+		store.insert(id, value);
+	}
+	return in;
+}
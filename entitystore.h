@@ -0,0 +1,115 @@
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+#include "entityproperty.h"
+#include <QtGlobal>
+
+class QDataStream;
+
+// Per entity key-value memory used by Copy, Load, LoadEntityStore and CopyEntityStore.
+// Small open addressing table with linear probing that lives inline in the Entity.
+// Capacity is fixed: when the table is full, storing a new id replaces the entry in the
+// id's home slot. Loading an id that isn't stored returns 0.
+class EntityStore {
+	public:
+		static const int Capacity = 8;
+
+		EntityStore();
+
+		EntityProperty value(EntityProperty::ValueType id) const;
+		bool contains(EntityProperty::ValueType id) const;
+		void insert(EntityProperty::ValueType id, EntityProperty value);
+		void clear();
+
+		int size() const;
+		bool isEmpty() const;
+
+		// Bytes one store takes. Every entity has two: its own and the copy in its
+		// sensed state.
+		static int memoryUsage();
+
+		friend QDataStream &operator << (QDataStream &out, const EntityStore &store);
+		friend QDataStream &operator >> (QDataStream &in, EntityStore &store);
+	private:
+		static int homeSlot(EntityProperty::ValueType id);
+		int find(EntityProperty::ValueType id) const;
+
+		EntityProperty::ValueType mKeys[Capacity];
+		EntityProperty mValues[Capacity];
+		quint8 mUsedSlots;
+};
+
+QDataStream &operator << (QDataStream &out, const EntityStore &store);
+QDataStream &operator >> (QDataStream &in, EntityStore &store);
+
+inline EntityStore::EntityStore() :
+	mUsedSlots(0) {
+}
+
+inline int EntityStore::homeSlot(EntityProperty::ValueType id) {
+	// Fibonacci hashing, top bits of the 16 bit product
+	return (quint16)(id * 40503u) >> 13;
+}
+
+inline int EntityStore::find(EntityProperty::ValueType id) const {
+	int slot = homeSlot(id);
+	for (int i = 0; i < Capacity; i++) {
+		if (!(mUsedSlots & (1 << slot))) return -1;
+		if (mKeys[slot] == id) return slot;
+		slot = (slot + 1) & (Capacity - 1);
+	}
+	return -1;
+}
+
+inline EntityProperty EntityStore::value(EntityProperty::ValueType id) const {
+	int slot = find(id);
+	if (slot < 0) return EntityProperty();
+	return mValues[slot];
+}
+
+inline bool EntityStore::contains(EntityProperty::ValueType id) const {
+	return find(id) >= 0;
+}
+
+inline void EntityStore::insert(EntityProperty::ValueType id, EntityProperty value) {
+	int slot = homeSlot(id);
+	for (int i = 0; i < Capacity; i++) {
+		if (!(mUsedSlots & (1 << slot))) {
+			mUsedSlots |= 1 << slot;
+			mKeys[slot] = id;
+			mValues[slot] = value;
+			return;
+		}
+		if (mKeys[slot] == id) {
+			mValues[slot] = value;
+			return;
+		}
+		slot = (slot + 1) & (Capacity - 1);
+	}
+
+	// Full. Replacing an entry in place keeps every probe chain intact.
+	slot = homeSlot(id);
+	mKeys[slot] = id;
+	mValues[slot] = value;
+}
+
+inline void EntityStore::clear() {
+	mUsedSlots = 0;
+}
+
+inline int EntityStore::size() const {
+	int count = 0;
+	for (int i = 0; i < Capacity; i++) {
+		if (mUsedSlots & (1 << i)) count++;
+	}
+	return count;
+}
+
+inline bool EntityStore::isEmpty() const {
+	return mUsedSlots == 0;
+}
+
+inline int EntityStore::memoryUsage() {
+	return sizeof(EntityStore);
+}
+
+#endif // ENTITYSTORE_H
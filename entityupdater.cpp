@@ -0,0 +1,137 @@
+#include "entityupdater.h"
+#include "entity.h"
+#include "map.h"
+#ifdef BATCH_INTERPRETER
+#include "batchinterpreter.h"
+#include <QHash>
+#endif
+
+EntityUpdater::EntityUpdater(Map *map) :
+	mMap(map),
+	mEntities(&map->entities()),
+	mSize(0) {
+
+}
+
+void EntityUpdater::beginTick() {
+	mSize = mEntities->size();
+	mActions.resize(mSize);
+	mActive.resize(mSize);
+}
+
+void EntityUpdater::beginUpdates(int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		mActions[i] = Action();
+		mActive[i] = mEntities->at(i)->beginUpdate(mMap);
+	}
+}
+
+void EntityUpdater::runPrograms(int begin, int end) {
+#ifdef BATCH_INTERPRETER
+	runBatched(begin, end);
+#else
+	for (int i = begin; i < end; i++) {
+		if (!mActive[i]) continue;
+		Entity *entity = mEntities->at(i);
+		int instructionCounter;
+		entity->exec(mMap, Entity::maxInstructions, instructionCounter, mActions[i]);
+		entity->endUpdate(instructionCounter);
+	}
+#endif
+}
+
+#ifdef BATCH_INTERPRETER
+void EntityUpdater::runBatched(int begin, int end) {
+	const int count = end - begin;
+	// Entities that don't act keep the empty action from beginUpdates
+	Action *actions = mActions.data() + begin;
+	const bool *active = mActive.constData() + begin;
+	QVector<int> instructionCounters(count, 0);
+
+	// Genomes with enough entities to fill a batch get a group, in order of appearance.
+	// Everything else runs right away, ahead of the groups. The order is free, as the
+	// programs only sense each other through the state published by beginUpdates.
+	QHash<const Genome*, int> groupIndices;
+	QVector<int> entityGroups(count, -1);
+	QVector<int> groupOffsets;
+	for (int i = 0; i < count; i++) {
+		if (!active[i]) continue;
+		Entity *entity = mEntities->at(begin + i);
+		const Genome *genome = entity->genome().constData();
+		bool batched = genome->population() >= BatchInterpreter::MinLanes;
+#ifdef ENABLE_JIT
+		if (genome->program().nativeCode()) batched = false;
+#endif
+		if (!batched) {
+			entity->exec(mMap, Entity::maxInstructions, instructionCounters[i], actions[i]);
+			continue;
+		}
+
+		QHash<const Genome*, int>::const_iterator group = groupIndices.constFind(genome);
+		if (group == groupIndices.constEnd()) {
+			group = groupIndices.insert(genome, groupOffsets.size());
+			groupOffsets.append(0);
+		}
+		entityGroups[i] = group.value();
+		groupOffsets[group.value()]++;
+	}
+
+	// Counting sort by group, keeping the entity order inside a group
+	int groupedEntities = 0;
+	for (int &offset : groupOffsets) {
+		int size = offset;
+		offset = groupedEntities;
+		groupedEntities += size;
+	}
+	groupOffsets.append(groupedEntities);
+	QVector<int> grouped(groupedEntities);
+	QVector<int> groupEnds = groupOffsets;
+	for (int i = 0; i < count; i++) {
+		if (entityGroups[i] >= 0) grouped[groupEnds[entityGroups[i]]++] = i;
+	}
+
+	BatchInterpreter batch(mMap);
+	Entity *laneEntities[BatchInterpreter::MaxLanes];
+	Action laneActions[BatchInterpreter::MaxLanes];
+	int laneInstructionCounters[BatchInterpreter::MaxLanes];
+	for (int group = 0; group < groupOffsets.size() - 1; group++) {
+		const int groupEnd = groupOffsets[group + 1];
+		for (int first = groupOffsets[group]; first < groupEnd; first += BatchInterpreter::MaxLanes) {
+			int lanes = qMin((int)BatchInterpreter::MaxLanes, groupEnd - first);
+			for (int lane = 0; lane < lanes; lane++) {
+				laneEntities[lane] = mEntities->at(begin + grouped[first + lane]);
+			}
+			batch.exec(laneEntities, lanes, Entity::maxInstructions, laneActions, laneInstructionCounters);
+			for (int lane = 0; lane < lanes; lane++) {
+				actions[grouped[first + lane]] = laneActions[lane];
+				instructionCounters[grouped[first + lane]] = laneInstructionCounters[lane];
+			}
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (!active[i]) continue;
+		mEntities->at(begin + i)->endUpdate(instructionCounters[i]);
+	}
+}
+#endif
+
+void EntityUpdater::reserveChildren() {
+	for (Action &action : mActions) {
+		if (action.type() == Action::Reproduce) action.reserveChild(mMap);
+	}
+}
+
+void EntityUpdater::execThreadedActions(int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		Action &action = mActions[i];
+		if (action.canBeThreaded()) {
+			EntityProperty result = action.exec(mMap);
+			action.entity(mMap)->reportActionResult(result);
+			action = Action();
+		}
+		else if (action.type() == Action::Reproduce) {
+			action.buildChild(mMap);
+		}
+	}
+}
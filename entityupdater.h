@@ -0,0 +1,68 @@
+#ifndef ENTITYUPDATER_H
+#define ENTITYUPDATER_H
+
+#include <QList>
+#include <QVector>
+#include "action.h"
+class Entity;
+class Map;
+
+// Updates the map's entities once per tick, on index ranges of the entity list handed
+// out by the scheduler. Every entity has a slot for the action its program chose, so
+// the actions stay in entity order however the ranges were spread over the threads.
+//
+// beginUpdates runs Entity::beginUpdate, which publishes what other entities sense of
+// an entity. It has to finish for all entities before runPrograms runs the programs, so
+// a program sees the same neighbours whichever thread runs it, in whatever order.
+//
+// execThreadedActions then executes the actions that can run in parallel: Eat, Drink
+// and Heal only touch the acting entity and the tile it stands on, so they give the
+// same results in any order. Children of Reproduce actions are built there as well,
+// they are placed by the worker. This has to wait until every program has run, as
+// programs read the tiles and entities around them.
+class EntityUpdater {
+	public:
+#ifdef BATCH_INTERPRETER
+		// Ranges have to be large enough to fill batches with entities of one genome
+		static const int ProgramGrain = 512;
+#else
+		static const int ProgramGrain = 32;
+#endif
+		static const int ActionGrain = 512;
+
+		EntityUpdater(Map *map);
+
+		// Sizes the action slots for the current entity list. Children added to the
+		// list later in the tick get no slot.
+		void beginTick();
+		int size() const;
+		void beginUpdates(int begin, int end);
+		void runPrograms(int begin, int end);
+		// Runs Action::reserveChild of the Reproduce actions, in entity order
+		void reserveChildren();
+		void execThreadedActions(int begin, int end);
+
+		// Action of every entity, empty if it chose none or it was already executed
+		QVector<Action> &actions();
+	private:
+#ifdef BATCH_INTERPRETER
+		void runBatched(int begin, int end);
+#endif
+
+		Map *mMap;
+		const QList<Entity*> *mEntities;
+		int mSize;
+		QVector<Action> mActions;
+		// Whether each entity runs its program this tick, set by beginUpdates
+		QVector<bool> mActive;
+};
+
+inline int EntityUpdater::size() const {
+	return mSize;
+}
+
+inline QVector<Action> &EntityUpdater::actions() {
+	return mActions;
+}
+
+#endif // ENTITYUPDATER_H
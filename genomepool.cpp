@@ -0,0 +1,81 @@
+#include "genomepool.h"
+#include "entity.h"
+#include <QMutexLocker>
+#include <climits>
+
+Genome::Genome(const QVector<Instruction> &byteCode, uint hash) :
+	mByteCode(byteCode),
+	mProgram(Entity::compileProgram(byteCode)),
+	mHash(hash)
+#ifdef DECISION_MEMO
+	, mMemo(&mProgram)
+#endif
+	{
+	EntityProperty::ValueType checkSum = 0;
+	for (const Instruction &ins : mByteCode) {
+		checkSum ^= (EntityProperty::ValueType)ins.mOpCode;
+		checkSum = (checkSum << 1) | (checkSum >> (sizeof(checkSum)*CHAR_BIT-1));
+	}
+	mCheckSum = checkSum;
+	if (mCheckSum == EntityProperty::min()) mCheckSum = EntityProperty::max();
+}
+
+
+GenomePool::GenomePool() {
+
+}
+
+GenomePool::~GenomePool() {
+
+}
+
+GenomeHandle GenomePool::intern(const QVector<Instruction> &byteCode) {
+	uint hash = hashByteCode(byteCode);
+	QMutexLocker locker(&mMutex);
+	for (QMultiHash<uint, GenomeHandle>::const_iterator i = mGenomes.constFind(hash); i != mGenomes.constEnd() && i.key() == hash; ++i) {
+		if (i.value()->byteCode() == byteCode) {
+			return i.value();
+		}
+	}
+	GenomeHandle genome(new Genome(byteCode, hash));
+	mGenomes.insert(hash, genome);
+	return genome;
+}
+
+void GenomePool::collectGarbage() {
+	for (QMultiHash<uint, GenomeHandle>::iterator i = mGenomes.begin(); i != mGenomes.end();) {
+		if (i.value()->population() == 0) {
+			i = mGenomes.erase(i);
+		}
+		else {
+			++i;
+		}
+	}
+}
+
+int GenomePool::size() const {
+	return mGenomes.size();
+}
+
+#ifdef DECISION_MEMO
+DecisionMemoStatistics GenomePool::takeMemoStatistics() {
+	DecisionMemoStatistics statistics = {0, 0, 0, 0};
+	for (QMultiHash<uint, GenomeHandle>::iterator i = mGenomes.begin(); i != mGenomes.end(); ++i) {
+		DecisionMemo &memo = i.value()->memo();
+		statistics.mHits += memo.hits();
+		statistics.mMisses += memo.misses();
+		statistics.mFallbacks += memo.fallbacks();
+		statistics.mMemory += memo.memoryUsage();
+		memo.resetCounters();
+	}
+	return statistics;
+}
+#endif
+
+uint GenomePool::hashByteCode(const QVector<Instruction> &byteCode) {
+	uint hash = byteCode.size();
+	for (const Instruction &ins : byteCode) {
+		hash = hash * 31 + (((uint)ins.mOpCode << 16) | ins.mParam);
+	}
+	return hash;
+}
@@ -0,0 +1,96 @@
+#ifndef GENOMEPOOL_H
+#define GENOMEPOOL_H
+#include <QSharedData>
+#include <QExplicitlySharedDataPointer>
+#include <QMultiHash>
+#include <QMutex>
+#include <QVector>
+#include "instruction.h"
+#include "program.h"
+#ifdef DECISION_MEMO
+#include "decisionmemo.h"
+#endif
+
+// Bytecode shared by every entity with an identical genome, together with the data
+// derived from it.
+class Genome : public QSharedData {
+	public:
+		const QVector<Instruction> &byteCode() const;
+		const Program &program() const;
+		EntityProperty checkSum() const;
+		uint hash() const;
+#ifdef DECISION_MEMO
+		DecisionMemo &memo() const;
+#endif
+
+		// Number of entities using this genome
+		int population() const;
+	private:
+		friend class GenomePool;
+		Genome(const QVector<Instruction> &byteCode, uint hash);
+
+		QVector<Instruction> mByteCode;
+		Program mProgram;
+		EntityProperty mCheckSum;
+		uint mHash;
+#ifdef DECISION_MEMO
+		mutable DecisionMemo mMemo;
+#endif
+};
+
+typedef QExplicitlySharedDataPointer<Genome> GenomeHandle;
+
+// Content hashed store of genomes. Identical bytecode is interned into a single Genome.
+// The pool keeps one reference to every genome; genomes nobody else references are
+// dropped by collectGarbage.
+class GenomePool {
+	public:
+		GenomePool();
+		~GenomePool();
+
+		// Thread safe
+		GenomeHandle intern(const QVector<Instruction> &byteCode);
+
+		// Must not run concurrently with intern
+		void collectGarbage();
+
+		int size() const;
+#ifdef DECISION_MEMO
+		// Sums up the memos of all genomes and resets their counters. Must not run
+		// concurrently with the programs.
+		DecisionMemoStatistics takeMemoStatistics();
+#endif
+		static uint hashByteCode(const QVector<Instruction> &byteCode);
+	private:
+		QMutex mMutex;
+		QMultiHash<uint, GenomeHandle> mGenomes;
+};
+
+inline const QVector<Instruction> &Genome::byteCode() const {
+	return mByteCode;
+}
+
+inline const Program &Genome::program() const {
+	return mProgram;
+}
+
+inline EntityProperty Genome::checkSum() const {
+	return mCheckSum;
+}
+
+inline uint Genome::hash() const {
+	return mHash;
+}
+
+#ifdef DECISION_MEMO
+inline DecisionMemo &Genome::memo() const {
+	return mMemo;
+}
+#endif
+
+inline int Genome::population() const {
+	// The pool holds one of the references
+	return ref.load() - 1;
+}
+
+#endif // GENOMEPOOL_H
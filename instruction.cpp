@@ -0,0 +1,16 @@
+#include "instruction.h"
+#include <QDataStream>
+
+QDataStream &operator <<(QDataStream &out, const Instruction &ins) {
+	out << (int)ins.mOpCode;
+	out << ins.mParam;
+	return out;
+}
+
+
+QDataStream &operator >>(QDataStream &in, Instruction &ins) {
+	int opCode;
+	in >> opCode >> ins.mParam;
+	ins.mOpCode = (OpCode)opCode;
+	return in;
+}
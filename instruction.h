@@ -0,0 +1,83 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+#include "entityproperty.h"
+
+enum class OpCode : quint8 {
+	Literal,
+	LiteralPrimary,
+	LiteralSecondary,
+	Copy,
+	CopyResultToPrimary,
+	CopyResultToSecondary,
+	Load,
+	Equal,
+	Greater,
+	Add,
+	Substract,
+	And,
+	Or,
+	Not,
+	True,
+	SetSpeed,
+	SetPower,
+	GetSpeed,
+	GetPower,
+	GetHealt,
+	GetMaxHealt,
+	GetEnergy,
+	Eat,
+	Move,
+	Attack,
+	Heal,
+	ResetTargetMarker,
+	MoveTargetMarker,
+	IsTargetMarkerOnMap,
+	GetFoodLevel,
+	ContainsEntity,
+
+	EntityCheckSum,
+	SelfCheckSum,
+
+	CheckEntityHealth,
+	CheckEntitySpeed,
+
+	ConditionalJump,
+	Jump,
+
+	Reproduce,
+
+	LoadEntityStore,
+	CopyEntityStore,
+
+	Drink,
+
+	CheckHydrationLevel,
+	CheckWaterLevel,
+	CheckHeatLevel,
+
+
+	MaxOpCode,
+
+	// Superinstructions fused from common op code sequences by Program::compile.
+	// These never appear in a genome.
+	SetTargetMarker,
+	PrimaryJump,
+	GreaterJump,
+	ContainsEntityJump,
+	SenseEntityJump,
+	CompareEnergyJump,
+
+	MaxInternalOpCode
+};
+
+struct Instruction {
+	Instruction() : mOpCode(OpCode::MaxOpCode), mParam(0) {}
+	Instruction(OpCode code, EntityProperty::ValueType param) : mOpCode(code), mParam(param) {}
+	bool operator == (const Instruction &o) const { return mOpCode == o.mOpCode && mParam == o.mParam; }
+	OpCode mOpCode;
+	EntityProperty::ValueType mParam;
+};
+
+QDataStream &operator << (QDataStream &out, const Instruction &ins);
+QDataStream &operator >> (QDataStream &in, Instruction &ins);
+#endif // INSTRUCTION_H
@@ -0,0 +1,528 @@
+#include "jit.h"
+#include "program.h"
+#include "entity.h"
+#include <QByteArray>
+#include <QVector>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X86_64
+#endif
+
+#ifdef JIT_X86_64
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace {
+// A program is compiled once it has run this many instructions in total...
+const quint64 jitInstructionThreshold = 2000000;
+// ...or once this many entities share it.
+const int jitPopulationThreshold = 100;
+
+#ifdef JIT_X86_64
+enum Register {
+	Eax, Ecx, Edx, Ebx, Esp, Ebp, Esi, Edi,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum Condition {
+	Below = 0x2,
+	Equal = 0x4,
+	NotEqual = 0x5,
+	Above = 0x7
+};
+
+// Register allocation of the generated code.
+// All values are kept zero extended to 32 bits.
+const Register stateRegister = Edi;
+const Register resultRegister = Ebx;
+const Register primaryRegister = R12;
+const Register secondaryRegister = R13;
+const Register budgetRegister = R14;
+const Register markerXRegister = R15;
+const Register markerYRegister = Ebp;
+const Register executionPointRegister = Esi;
+
+const Register calleeSavedRegisters[] = {
+	Ebx, Ebp, R12, R13, R14, R15,
+#ifdef Q_OS_WIN
+	Edi, Esi
+#endif
+};
+
+class Emitter {
+	public:
+		Emitter(int labelCount) : mLabels(labelCount, -1) {}
+
+		const QByteArray &code() const { return mCode; }
+		int position() const { return mCode.size(); }
+
+		void bind(int label) { mLabels[label] = position(); }
+		void resolve() {
+			for (const Fixup &fixup : mFixups) {
+				qint32 rel = mLabels.at(fixup.mLabel) - (fixup.mPosition + 4);
+				memcpy(mCode.data() + fixup.mPosition, &rel, sizeof(rel));
+			}
+		}
+
+		void byte(quint8 b) { mCode.append((char)b); }
+		void dword(quint32 v) {
+			for (int i = 0; i < 4; i++) byte((v >> (i * 8)) & 0xFF);
+		}
+		void align(int alignment) {
+			while (position() % alignment) byte(0xCC);
+		}
+		void labelOffset(int label, int base) {
+			dword(mLabels.at(label) - base);
+		}
+
+		void push(Register r) {
+			if (r & 8) byte(0x41);
+			byte(0x50 | (r & 7));
+		}
+		void pop(Register r) {
+			if (r & 8) byte(0x41);
+			byte(0x58 | (r & 7));
+		}
+		void ret() { byte(0xC3); }
+
+		void mov(Register dst, Register src) { regReg(0x89, src, dst); }
+		void mov64(Register dst, Register src) {
+			rex(true, src, dst);
+			byte(0x89);
+			modRM(src, dst);
+		}
+		void add(Register dst, Register src) { regReg(0x01, src, dst); }
+		void sub(Register dst, Register src) { regReg(0x29, src, dst); }
+		void andReg(Register dst, Register src) { regReg(0x21, src, dst); }
+		void orReg(Register dst, Register src) { regReg(0x09, src, dst); }
+		void xorReg(Register dst, Register src) { regReg(0x31, src, dst); }
+		void cmp(Register a, Register b) { regReg(0x39, b, a); }
+		void test(Register a, Register b) { regReg(0x85, b, a); }
+		void cmov(Condition cond, Register dst, Register src) {
+			rex(false, dst, src);
+			byte(0x0F);
+			byte(0x40 | cond);
+			modRM(dst, src);
+		}
+		// Only for Eax..Ebx, so no REX prefix is needed for the byte register
+		void set(Condition cond, Register dst) {
+			byte(0x0F);
+			byte(0x90 | cond);
+			byte(0xC0 | dst);
+		}
+		void imul(Register dst, Register src, quint32 imm) {
+			rex(false, dst, src);
+			byte(0x69);
+			modRM(dst, src);
+			dword(imm);
+		}
+		void movImm(Register dst, quint32 imm) {
+			rex(false, Eax, dst);
+			byte(0xB8 | (dst & 7));
+			dword(imm);
+		}
+		void inc(Register r) {
+			rex(false, Eax, r);
+			byte(0xFF);
+			byte(0xC0 | (r & 7));
+		}
+		void dec(Register r) {
+			rex(false, Eax, r);
+			byte(0xFF);
+			byte(0xC8 | (r & 7));
+		}
+
+		void load(Register dst, int offset) {
+			rex(false, dst, stateRegister);
+			byte(0x8B);
+			byte(0x40 | ((dst & 7) << 3) | (stateRegister & 7));
+			byte(offset);
+		}
+		void store(int offset, Register src) {
+			rex(false, src, stateRegister);
+			byte(0x89);
+			byte(0x40 | ((src & 7) << 3) | (stateRegister & 7));
+			byte(offset);
+		}
+		void storeImm(int offset, quint32 imm) {
+			byte(0xC7);
+			byte(0x40 | (stateRegister & 7));
+			byte(offset);
+			dword(imm);
+		}
+
+		void jmp(int label) {
+			byte(0xE9);
+			fixup(label);
+		}
+		void jcc(Condition cond, int label) {
+			byte(0x0F);
+			byte(0x80 | cond);
+			fixup(label);
+		}
+
+		// Jumps to the label whose offset from the table is stored at table[index]
+		void jumpTable(int tableLabel, Register index) {
+			Q_ASSERT(index < R8);
+			// lea rcx, [rip + table]
+			byte(0x48); byte(0x8D); byte(0x0D);
+			fixup(tableLabel);
+			// movsxd rax, dword [rcx + index * 4]
+			byte(0x48);
+			byte(0x63);
+			byte(0x04);
+			byte(0x80 | ((index & 7) << 3) | Ecx);
+			// add rax, rcx
+			byte(0x48); byte(0x01); byte(0xC8);
+			// jmp rax
+			byte(0xFF); byte(0xE0);
+		}
+	private:
+		struct Fixup {
+			int mPosition;
+			int mLabel;
+		};
+
+		void rex(bool wide, int reg, int rm) {
+			quint8 prefix = 0x40 | (wide ? 0x8 : 0) | ((reg & 8) ? 0x4 : 0) | ((rm & 8) ? 0x1 : 0);
+			if (prefix != 0x40) byte(prefix);
+		}
+		void modRM(int reg, int rm) {
+			byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+		}
+		void regReg(quint8 op, int reg, int rm) {
+			rex(false, reg, rm);
+			byte(op);
+			modRM(reg, rm);
+		}
+		void fixup(int label) {
+			Fixup f;
+			f.mPosition = position();
+			f.mLabel = label;
+			mFixups.append(f);
+			dword(0);
+		}
+
+		QByteArray mCode;
+		QVector<int> mLabels;
+		QVector<Fixup> mFixups;
+};
+
+bool isCompiled(OpCode opCode) {
+	switch (opCode) {
+		case OpCode::Literal:
+		case OpCode::LiteralPrimary:
+		case OpCode::LiteralSecondary:
+		case OpCode::CopyResultToPrimary:
+		case OpCode::CopyResultToSecondary:
+		case OpCode::Equal:
+		case OpCode::Greater:
+		case OpCode::Add:
+		case OpCode::Substract:
+		case OpCode::And:
+		case OpCode::Or:
+		case OpCode::Not:
+		case OpCode::True:
+		case OpCode::SetSpeed:
+		case OpCode::SetPower:
+		case OpCode::GetSpeed:
+		case OpCode::GetPower:
+		case OpCode::GetHealt:
+		case OpCode::GetMaxHealt:
+		case OpCode::GetEnergy:
+		case OpCode::ResetTargetMarker:
+		case OpCode::MoveTargetMarker:
+		case OpCode::ConditionalJump:
+		case OpCode::Jump:
+		case OpCode::CheckHydrationLevel:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// result = condition ? EntityProperty::max() : EntityProperty::min()
+void emitBooleanResult(Emitter &e) {
+	e.imul(resultRegister, Eax, 0xFFFF);
+}
+
+void emitInstruction(Emitter &e, const ProgramInstruction &ins, int exitLabel) {
+	switch (ins.mOpCode) {
+		case OpCode::Literal:
+			e.movImm(resultRegister, ins.mParam);
+			break;
+		case OpCode::LiteralPrimary:
+			e.movImm(primaryRegister, ins.mParam);
+			break;
+		case OpCode::LiteralSecondary:
+			e.movImm(secondaryRegister, ins.mParam);
+			break;
+		case OpCode::CopyResultToPrimary:
+			e.mov(primaryRegister, resultRegister);
+			break;
+		case OpCode::CopyResultToSecondary:
+			e.mov(secondaryRegister, resultRegister);
+			break;
+		case OpCode::Equal:
+			e.xorReg(Eax, Eax);
+			e.cmp(primaryRegister, secondaryRegister);
+			e.set(Equal, Eax);
+			emitBooleanResult(e);
+			break;
+		case OpCode::Greater:
+			e.xorReg(Eax, Eax);
+			e.cmp(primaryRegister, secondaryRegister);
+			e.set(Above, Eax);
+			emitBooleanResult(e);
+			break;
+		case OpCode::Add:
+			// Saturates at EntityProperty::max()
+			e.mov(Eax, primaryRegister);
+			e.add(Eax, secondaryRegister);
+			e.movImm(Ecx, 0xFFFF);
+			e.cmp(Eax, Ecx);
+			e.cmov(Above, Eax, Ecx);
+			e.mov(resultRegister, Eax);
+			break;
+		case OpCode::Substract:
+			// Saturates at EntityProperty::min()
+			e.xorReg(Ecx, Ecx);
+			e.mov(Eax, primaryRegister);
+			e.sub(Eax, secondaryRegister);
+			e.cmov(Below, Eax, Ecx);
+			e.mov(resultRegister, Eax);
+			break;
+		case OpCode::And:
+		case OpCode::Or:
+			e.xorReg(Eax, Eax);
+			e.xorReg(Ecx, Ecx);
+			e.test(primaryRegister, primaryRegister);
+			e.set(NotEqual, Eax);
+			e.test(secondaryRegister, secondaryRegister);
+			e.set(NotEqual, Ecx);
+			if (ins.mOpCode == OpCode::And)
+				e.andReg(Eax, Ecx);
+			else
+				e.orReg(Eax, Ecx);
+			emitBooleanResult(e);
+			break;
+		case OpCode::Not:
+			e.xorReg(Eax, Eax);
+			e.test(primaryRegister, primaryRegister);
+			e.set(Equal, Eax);
+			emitBooleanResult(e);
+			break;
+		case OpCode::True:
+			e.xorReg(Eax, Eax);
+			e.test(primaryRegister, primaryRegister);
+			e.set(NotEqual, Eax);
+			emitBooleanResult(e);
+			break;
+		case OpCode::SetSpeed:
+			e.storeImm(offsetof(JitState, mSpeed), ins.mParam);
+			e.movImm(resultRegister, ins.mParam);
+			break;
+		case OpCode::SetPower:
+			e.storeImm(offsetof(JitState, mPower), ins.mParam);
+			e.movImm(resultRegister, ins.mParam);
+			break;
+		case OpCode::GetSpeed:
+			e.load(resultRegister, offsetof(JitState, mSpeed));
+			break;
+		case OpCode::GetPower:
+			e.load(resultRegister, offsetof(JitState, mPower));
+			break;
+		case OpCode::GetHealt:
+			e.load(resultRegister, offsetof(JitState, mHealth));
+			break;
+		case OpCode::GetMaxHealt:
+			e.load(resultRegister, offsetof(JitState, mMaxHealth));
+			break;
+		case OpCode::GetEnergy:
+			e.load(resultRegister, offsetof(JitState, mEnergy));
+			break;
+		case OpCode::CheckHydrationLevel:
+			e.load(resultRegister, offsetof(JitState, mHydration));
+			break;
+		case OpCode::ResetTargetMarker:
+			e.xorReg(markerXRegister, markerXRegister);
+			e.xorReg(markerYRegister, markerYRegister);
+			break;
+		case OpCode::MoveTargetMarker:
+			switch ((Direction)ins.mParam) {
+				case Left:
+					e.dec(markerXRegister);
+					break;
+				case Right:
+					e.inc(markerXRegister);
+					break;
+				case Up:
+					e.dec(markerYRegister);
+					break;
+				case Down:
+					e.inc(markerYRegister);
+					break;
+			}
+			break;
+		case OpCode::ConditionalJump:
+			e.test(primaryRegister, primaryRegister);
+			e.jcc(NotEqual, ins.mJumpTarget);
+			break;
+		case OpCode::Jump:
+			e.jmp(ins.mJumpTarget);
+			break;
+		default:
+			e.jmp(exitLabel);
+			break;
+	}
+}
+
+void *allocateExecutable(const QByteArray &code) {
+#ifdef Q_OS_WIN
+	void *mem = VirtualAlloc(0, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!mem) return 0;
+	memcpy(mem, code.constData(), code.size());
+	DWORD oldProtect;
+	if (!VirtualProtect(mem, code.size(), PAGE_EXECUTE_READ, &oldProtect)) {
+		VirtualFree(mem, 0, MEM_RELEASE);
+		return 0;
+	}
+	FlushInstructionCache(GetCurrentProcess(), mem, code.size());
+	return mem;
+#else
+	void *mem = mmap(0, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return 0;
+	memcpy(mem, code.constData(), code.size());
+	if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, code.size());
+		return 0;
+	}
+	return mem;
+#endif
+}
+
+void freeExecutable(void *mem, size_t size) {
+#ifdef Q_OS_WIN
+	Q_UNUSED(size);
+	VirtualFree(mem, 0, MEM_RELEASE);
+#else
+	munmap(mem, size);
+#endif
+}
+#endif
+}
+
+JitCode::JitCode(void *code, size_t size) :
+	mCode(code),
+	mSize(size) {
+
+}
+
+JitCode::~JitCode() {
+#ifdef JIT_X86_64
+	freeExecutable(mCode, mSize);
+#endif
+}
+
+bool JitCode::isSupported() {
+#ifdef JIT_X86_64
+	return true;
+#else
+	return false;
+#endif
+}
+
+JitCode *JitCode::compile(const Program &program) {
+#ifdef JIT_X86_64
+	const int size = program.size();
+	if (size == 0) return 0;
+
+	// Labels 0..size-1 are the instructions
+	const int exitLabel = size;
+	const int tableLabel = size + 1;
+	Emitter e(size + 2);
+
+	for (Register r : calleeSavedRegisters) e.push(r);
+#ifdef Q_OS_WIN
+	e.mov64(stateRegister, Ecx);
+#endif
+	e.load(resultRegister, offsetof(JitState, mResultRegister));
+	e.load(primaryRegister, offsetof(JitState, mPrimaryRegister));
+	e.load(secondaryRegister, offsetof(JitState, mSecondaryRegister));
+	e.load(markerXRegister, offsetof(JitState, mTargetMarkerX));
+	e.load(markerYRegister, offsetof(JitState, mTargetMarkerY));
+	e.load(budgetRegister, offsetof(JitState, mBudget));
+	e.load(executionPointRegister, offsetof(JitState, mExecutionPoint));
+	e.jumpTable(tableLabel, executionPointRegister);
+
+	for (int i = 0; i < size; i++) {
+		const ProgramInstruction &ins = program.instruction(i);
+		e.bind(i);
+		e.movImm(executionPointRegister, i);
+		if (!isCompiled(ins.mOpCode)) {
+			e.jmp(exitLabel);
+			continue;
+		}
+		e.test(budgetRegister, budgetRegister);
+		e.jcc(Equal, exitLabel);
+		e.dec(budgetRegister);
+		emitInstruction(e, ins, exitLabel);
+		if (ins.mOpCode != OpCode::Jump && ins.mNext != i + 1) {
+			e.jmp(ins.mNext);
+		}
+	}
+
+	e.bind(exitLabel);
+	e.store(offsetof(JitState, mExecutionPoint), executionPointRegister);
+	e.store(offsetof(JitState, mBudget), budgetRegister);
+	e.store(offsetof(JitState, mResultRegister), resultRegister);
+	e.store(offsetof(JitState, mPrimaryRegister), primaryRegister);
+	e.store(offsetof(JitState, mSecondaryRegister), secondaryRegister);
+	e.store(offsetof(JitState, mTargetMarkerX), markerXRegister);
+	e.store(offsetof(JitState, mTargetMarkerY), markerYRegister);
+	for (int i = sizeof(calleeSavedRegisters) / sizeof(Register) - 1; i >= 0; i--) e.pop(calleeSavedRegisters[i]);
+	e.ret();
+
+	e.align(4);
+	e.bind(tableLabel);
+	const int tablePosition = e.position();
+	for (int i = 0; i < size; i++) e.labelOffset(i, tablePosition);
+	e.resolve();
+
+	void *mem = allocateExecutable(e.code());
+	if (!mem) return 0;
+	return new JitCode(mem, e.code().size());
+#else
+	Q_UNUSED(program);
+	return 0;
+#endif
+}
+
+
+JitCache::JitCache() :
+	mState(Interpreted),
+	mExecutedInstructions(0),
+	mCode(0) {
+
+}
+
+JitCache::~JitCache() {
+	delete mCode;
+}
+
+void JitCache::reportExecution(const Program &program, int instructions, int population) {
+	if (mState.load() != Interpreted) return;
+	quint64 executed = mExecutedInstructions.fetchAndAddRelaxed(instructions) + instructions;
+	if (executed < jitInstructionThreshold && population < jitPopulationThreshold) return;
+	if (!mState.testAndSetAcquire(Interpreted, Compiling)) return;
+
+	// If the program can't be compiled mCode stays null and the interpreter keeps running it
+	mCode = JitCode::compile(program);
+	mState.storeRelease(Compiled);
+}
@@ -0,0 +1,77 @@
+#ifndef JIT_H
+#define JIT_H
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+
+class Program;
+
+// Entity state the native code works on. Entity::exec copies its registers here
+// before entering native code and back when it returns.
+struct JitState {
+	qint32 mResultRegister;
+	qint32 mPrimaryRegister;
+	qint32 mSecondaryRegister;
+	qint32 mTargetMarkerX;
+	qint32 mTargetMarkerY;
+	qint32 mExecutionPoint;
+	qint32 mBudget;
+	qint32 mSpeed;
+	qint32 mPower;
+	qint32 mHealth;
+	qint32 mMaxHealth;
+	qint32 mEnergy;
+	qint32 mHydration;
+};
+
+// x86-64 machine code for one Program.
+// Instructions that only work on the registers and the entity's own stats are compiled
+// natively. Native code runs until it reaches an instruction it doesn't handle (map
+// sensing, the store, checksums and actions) or the instruction budget is spent, and
+// leaves mExecutionPoint pointing at the next instruction to run.
+class JitCode {
+	public:
+		~JitCode();
+		static JitCode *compile(const Program &program);
+		static bool isSupported();
+
+		void run(JitState *state) const;
+	private:
+		JitCode(void *code, size_t size);
+
+		typedef void (*EntryPoint)(JitState *state);
+		void *mCode;
+		size_t mSize;
+};
+
+// Hotness tracking for a Program. Native code is compiled once the program has been
+// executed enough times or enough entities share it.
+class JitCache {
+	public:
+		JitCache();
+		~JitCache();
+
+		const JitCode *code() const;
+		void reportExecution(const Program &program, int instructions, int population);
+	private:
+		enum State {
+			Interpreted,
+			Compiling,
+			Compiled
+		};
+
+		QAtomicInt mState;
+		QAtomicInteger<quint64> mExecutedInstructions;
+		JitCode *mCode;
+};
+
+inline void JitCode::run(JitState *state) const {
+	((EntryPoint)mCode)(state);
+}
+
+inline const JitCode *JitCache::code() const {
+	if (mState.loadAcquire() != Compiled) return 0;
+	return mCode;
+}
+
+#endif // JIT_H
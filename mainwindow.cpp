@@ -2,7 +2,6 @@
 #include "ui_mainwindow.h"
 #include "map.h"
 #include "entity.h"
-#include "entityupdatetask.h"
 #include "action.h"
 #include <QThreadPool>
 #include <QTimer>
@@ -187,34 +186,49 @@ void MainWindow::updateStopped() {
 }
 
 void MainWindow::showResults(const WorkResults &results) {
-	ui->statusBar->showMessage(tr("%1  : Entities: %2   Tasks: %3   Generation %4    Timings: %5, %6  (%7%)")
+	QStringList utilisation;
+	for (double threadUtilisation : results.mThreadUtilisation) {
+		utilisation.append(QString::number(qRound(threadUtilisation * 100)) + "%");
+	}
+	QString message = tr("%1  : Entities: %2   Threads: %3   Generation %4    Timings: %5, %6  (%7%)    Store: %8 entries, %9 KiB with sensed copies")
 							   .arg(results.mTicks)
 							   .arg(results.mEntities)
-							   .arg(results.mTaskSize)
+							   .arg(utilisation.join(' '))
 							   .arg(results.mGeneration)
 							   .arg(results.mExecutionTime)
 							   .arg(results.mTotalTime)
-							   .arg(results.mTotalTime ? (results.mExecutionTime * 100 / results.mTotalTime) : 0));
+							   .arg(results.mTotalTime ? (results.mExecutionTime * 100 / results.mTotalTime) : 0)
+							   .arg(results.mStoreEntries)
+							   .arg(results.mStoreMemory / 1024);
+#ifdef DECISION_MEMO
+	message += tr("    Memo: %1 hits, %2 misses, %3 fallbacks, %4 KiB")
+							   .arg(results.mMemo.mHits)
+							   .arg(results.mMemo.mMisses)
+							   .arg(results.mMemo.mFallbacks)
+							   .arg(results.mMemo.mMemory / 1024);
+#endif
+	ui->statusBar->showMessage(message);
 }
 
 void MainWindow::mapClicked(QPoint mapPoint) {
 	if (!mWorker) {
 		Map *map = ui->mapViewWidget->map();
-		const Tile &tile = map->tile(Position(mapPoint.x(), mapPoint.y()));
+		Position position(mapPoint.x(), mapPoint.y());
 		QString msg = tr("Food V:%1 M:%2  Water:%3  Heat:%4").arg(
-					QString::number(tile.foodLevel(FoodType::V).value()),
-					QString::number(tile.foodLevel(FoodType::M).value()),
-					QString::number(tile.mWaterLevel.value()),
-					QString::number(tile.mHeat));
-		if (tile.mEntity) {
+					QString::number(map->foodLevel(position, FoodType::V).value()),
+					QString::number(map->foodLevel(position, FoodType::M).value()),
+					QString::number(map->waterLevel(position).value()),
+					QString::number(map->heat(position)));
+		Entity *entity = map->entity(position);
+		if (entity) {
 			msg += tr("  Health:%1  Energy:%2  Hydration:%3  Gen:%4  Age:%5  Adaptation F:%6 H:%7").arg(
-						QString::number(tile.mEntity->health().value()),
-						QString::number(tile.mEntity->energy().value()),
-						QString::number(tile.mEntity->hydration().value()),
-						QString::number(tile.mEntity->generation()),
-						QString::number(tile.mEntity->lifeTime()),
-						QString::number(tile.mEntity->foodLevelAdaption().value()),
-						QString::number(tile.mEntity->hydrationAdaption().value()));
+						QString::number(entity->health().value()),
+						QString::number(entity->energy().value()),
+						QString::number(entity->hydration().value()),
+						QString::number(entity->generation()),
+						QString::number(entity->lifeTime()),
+						QString::number(entity->foodLevelAdaption().value()),
+						QString::number(entity->hydrationAdaption().value()));
 		}
 		ui->statusBar->showMessage(msg);
 
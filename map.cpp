@@ -3,13 +3,32 @@
 #include <QPainter>
 #include <QFile>
 #include <QDataStream>
+#include <algorithm>
 #include <cassert>
+#include <random>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+quint64 randomSeed() {
+	std::random_device device;
+	return (quint64)device() << 32 | device();
+}
+
+}
 
 Map::Map() :
 	mTick (0),
 	mWidth(0),
 	mHeight(0),
-	mRandomGenerator(std::random_device()()) {
+	mSeed(randomSeed()),
+	mRandom(mSeed),
+	mNextEntityId(1) {
+#ifdef BLOCKED_TILES
+	mBlocksPerRow = 0;
+#endif
 
 	mCurrentBuffer = 0;
 	mDrawModes[0] = 1;
@@ -24,8 +43,12 @@ Map::Map(const QImage &img) :
 	mTick(0),
 	mWidth(img.width()),
 	mHeight(img.height()),
-	mTiles(img.height() * img.width()),
-	mRandomGenerator(std::random_device()()) {
+	mSeed(randomSeed()),
+	mRandom(mSeed),
+	mNextEntityId(1) {
+#ifdef BLOCKED_TILES
+	mBlocksPerRow = 0;
+#endif
 	assert(mWidth > 0);
 
 	mCurrentBuffer = 0;
@@ -33,20 +56,22 @@ Map::Map(const QImage &img) :
 	mDrawModes[1] = 2;
 	mDrawModes[2] = 3;
 
+	resizeTiles();
 	for (int y = 0; y < mHeight; y++) {
 		for (int x = 0; x < mWidth; x++) {
-			Tile &t = tile(Position(x, y));
-			t.mWaterLevel = 10;
-			t.mFoodLevels[(int)FoodType::V] = 400;
+			const int index = tileIndex(Position(x, y));
+			waterLevel(Position(x, y)) = 10;
+			foodLevel(Position(x, y), FoodType::V) = 400;
 			QRgb rgb = img.pixel(x, y);
 			int r = (rgb & 0xFF0000) >> 16;
 			int g = (rgb & 0xFF00) >> 8;
 			int b = rgb & 0xFF;
-			t.mWaterGenLevel = b;
-			t.mFoodGenLevel = g;
-			t.mHeat = r;
+			mWaterGenLevels[index] = b;
+			mFoodGenLevels[index] = g;
+			mHeats[index] = r;
 		}
 	}
+	initializeTileConstants();
 
 	initializeDefaultByteCode();
 
@@ -55,7 +80,7 @@ Map::Map(const QImage &img) :
 }
 
 Map::~Map() {
-	qDeleteAll(mEntities);
+	for (Entity *entity : mEntities) mEntityPool.destroy(entity);
 }
 
 int Map::width() const {
@@ -66,24 +91,17 @@ int Map::height() const {
 	return mHeight;
 }
 
-Tile &Map::tile(Position position) {
-	return mTiles[position.x + mWidth * position.y];
-}
-
-const Tile &Map::tile(Position position) const {
-	return mTiles[position.x + mWidth * position.y];
-}
-
 bool Map::isMovableLocation(Position target) const {
 	if (!isPositionOnMap(target)) return false;
-	return tile(target).mEntity == 0;
+	return mOccupants[tileIndex(target)].isNull();
 }
 
 bool Map::move(Entity *entity, Position target) {
 	if (!isMovableLocation(target)) return false;
 
-	tile(entity->position()).mEntity = 0;
-	tile(target).mEntity = entity;
+	mOccupants[tileIndex(entity->position())] = EntityHandle();
+	catchUp(tileIndex(target));
+	mOccupants[tileIndex(target)] = entity->handle();
 	entity->setPosition(target);
 	return true;
 }
@@ -111,8 +129,10 @@ Position Map::findValidLocation(Position nearPos, int maxRange) {
 
 bool Map::addEntity(Entity *entity, Position pos) {
 	if (isMovableLocation(pos)) {
-		tile(pos).mEntity = entity;
+		catchUp(tileIndex(pos));
+		mOccupants[tileIndex(pos)] = entity->handle();
 		entity->setPosition(pos);
+		entity->setId(mNextEntityId++);
 		mEntities.append(entity);
 		return true;
 	}
@@ -120,104 +140,430 @@ bool Map::addEntity(Entity *entity, Position pos) {
 }
 
 
-int normalizeValue(EntityProperty property) {
-	return property.sqrt().value();
-}
-
 QImage Map::draw() {
 	if (noDraw()) return QImage();
 	QImage &curImage = mDrawBuffers[mCurrentBuffer];
-	for (int y = 0; y < mHeight; y++) {
-		QRgb *line = (QRgb*)curImage.scanLine(y);
-		for (int x = 0; x < mWidth; x++) {
+	snapshot(mDrawSnapshot);
+	if (mDrawSnapshot.isStatic()) {
+		QImage frame = mStaticFrameCache.find(mDrawSnapshot);
+		if (frame.isNull()) {
+			// Drawn into an image of its own, so the draw buffers never share its pixels
+			frame = QImage(mWidth, mHeight, QImage::Format_RGB32);
+			mDrawSnapshot.draw(frame.bits(), frame.bytesPerLine(), 0, mHeight);
+			mStaticFrameCache.insert(mDrawSnapshot, frame);
+		}
+		return frame;
+	}
+	mDrawSnapshot.draw(curImage.bits(), curImage.bytesPerLine(), 0, mHeight);
+	mCurrentBuffer = 1 - mCurrentBuffer;
+	return curImage;
+}
 
-			const Tile &t = tile(Position(x, y));
-			quint8 colors[3] = {0, 0, 0};
-			for (int i = 0; i < 3; i++) {
-				switch (mDrawModes[i]) {
-					case 0:
-						break;
-					case 1:
-						if (t.mEntity)
-							colors[i] = std::min(70 + normalizeValue(t.mEntity->energy()), 255);
-						break;
-					case 2:
-						colors[i] = normalizeValue(t.mFoodLevels[(int)FoodType::V]);
-						break;
-					case 3:
-						colors[i] = normalizeValue(t.mFoodLevels[(int)FoodType::M]);
-						break;
-					case 4:
-						colors[i] = normalizeValue(t.mWaterLevel);
-						break;
-					case 5:
-						colors[i] = t.mFoodGenLevel;
-						break;
-					case 6:
-						colors[i] = t.mWaterGenLevel;
-						break;
-					case 7:
-						colors[i] = t.mHeat;
-						break;
-					case 8:
-						if (t.mEntity && t.mEntity->isInBornState())
-							colors[i] = 255;
-					default:
-						break;
+void Map::snapshot(MapSnapshot &snapshot) const {
+	// Snapshots are row-major whatever order the tiles are stored in
+	const int count = mWidth * mHeight;
+	snapshot.mWidth = mWidth;
+	snapshot.mHeight = mHeight;
+	bool used[MapSnapshot::DrawModeCount] = {};
+	for (int i = 0; i < 3; i++) {
+		snapshot.mDrawModes[i] = mDrawModes[i];
+		if (mDrawModes[i] > 0 && mDrawModes[i] < MapSnapshot::DrawModeCount) used[mDrawModes[i]] = true;
+	}
+
+	for (int mode = 1; mode < MapSnapshot::DrawModeCount; mode++) {
+		if (!used[mode]) continue;
+		if (MapSnapshot::isLevelMode(mode)) {
+			QVector<EntityProperty> &levelBuffer = snapshot.mLevels[mode];
+			levelBuffer.resize(count);
+			EntityProperty *levels = levelBuffer.data();
+			for (int y = 0; y < mHeight; y++) {
+				for (int x = 0; x < mWidth; x++) {
+					const int i = tileIndex(Position(x, y));
+					switch (mode) {
+						case 2:
+							*levels++ = foodLevelAt(i, FoodType::V);
+							break;
+						case 3:
+							*levels++ = foodLevelAt(i, FoodType::M);
+							break;
+						default:
+							*levels++ = waterLevelAt(i);
+							break;
+					}
 				}
 			}
-			line[x] = qRgb(colors[0],colors[1], colors[2]);
+			continue;
+		}
+
+		if (MapSnapshot::isStaticMode(mode)) {
+			// Shares the plane, nothing is copied
+			snapshot.mValues[mode] = mStaticLayers[mode - 5];
+			continue;
+		}
+
+		QVector<quint8> &valueBuffer = snapshot.mValues[mode];
+		valueBuffer.resize(count);
+		quint8 *values = valueBuffer.data();
+		switch (mode) {
+			case 1:
+				std::fill(values, values + count, 0);
+				for (Entity *entity : mEntities) {
+					values[entity->position().x + mWidth * entity->position().y] = std::min(70 + MapSnapshot::sqrtTable()[entity->energy().value()], 255);
+				}
+				break;
+			case 8:
+				std::fill(values, values + count, 0);
+				for (Entity *entity : mEntities) {
+					if (entity->isInBornState()) values[entity->position().x + mWidth * entity->position().y] = 255;
+				}
+				break;
 		}
 	}
-	mCurrentBuffer = 1 - mCurrentBuffer;
-	return curImage;
+	snapshot.selectKernel();
 }
 
-void Map::updateFoodLevels() {
-	for (int y = 0; y < mHeight; y++) {
-		for (int x = 0; x < mWidth; x++) {
-			Tile &t = tile(Position(x, y));
-			t.mWaterLevel += EntityProperty(t.mWaterGenLevel) - t.mWaterLevel / t.mWaterGenLevel;
-			t.mFoodLevels[(int)FoodType::V] += std::max((int)sqrt(t.mFoodGenLevel * 10) - (int)t.mStressLevel.value() * t.mStressLevel.value(), 0);
-			if (t.mEntity)
-				t.mStressLevel += 3;
-			else
-				t.mStressLevel -= 1;
-			t.mFoodLevels[(int)FoodType::V] -= (t.mFoodLevels[(int)FoodType::V] / 10 * t.mFoodLevels[(int)FoodType::V] / 10) / 10000;
-			t.mFoodLevels[(int)FoodType::M] -= 10;
+void Map::updateFoodLevels(int beginRow, int endRow) {
+#ifdef BLOCKED_TILES
+	// Every row of a block is a run of BlockSize tiles, a vector's worth
+	for (int y = beginRow; y < endRow; y++) {
+		for (int x = 0; x < mWidth; x += BlockSize) {
+			const int begin = tileIndex(Position(x, y));
+			updateTileLevels(begin, begin + qMin((int)BlockSize, mWidth - x));
 		}
 	}
+#else
+	updateTileLevels(beginRow * mWidth, endRow * mWidth);
+#endif
+}
+
+#ifdef LAZY_TILES
+void Map::updateOccupiedFoodLevels(int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		const int index = tileIndex(mEntities.at(i)->position());
+		catchUp(index);
+		updateTileLevel(index);
+		mUpdatedTicks[index] = mTick + 1;
+	}
+}
+#endif
+
+void Map::advanceTick() {
 	mTick++;
 }
 
+namespace {
+
+typedef EntityProperty::ValueType Level;
+static_assert(sizeof(EntityProperty) == sizeof(Level), "Level planes are read as plain u16 arrays");
+
+#ifdef __AVX2__
+inline __m256i loadLevels(const Level *p) {
+	return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+}
+
+// Values have to be in [0, 65535]
+inline void storeLevels(Level *p, __m256i v) {
+	__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+	_mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(packed));
+}
+#endif
+
+// max(growth - stress * stress, 0) in wrapping int arithmetic, truncated to 16 bits like
+// the conversion to EntityProperty
+inline Level foodRegrowth(int growth, Level stress) {
+	qint32 regrowth = (qint32)((quint32)growth - (quint32)stress * stress);
+	return (Level)std::max(regrowth, 0);
+}
+
+#ifdef LAZY_TILES
+const int LevelMax = std::numeric_limits<Level>::max();
+
+// Water level after ticks updates. While water / waterGen stays the same the level rises
+// by the same amount every tick, so each such run is done in one step. Once the quotient
+// reaches waterGen the level stays, so there are at most waterGen runs.
+Level fastForwardWater(Level level, int waterGen, quint64 ticks) {
+	if (waterGen == 0) return level;
+	int water = level;
+	while (ticks > 0) {
+		int quotient = water / waterGen;
+		if (quotient >= waterGen) break;
+		int regrowth = waterGen - quotient;
+		quint64 run = std::min<quint64>(((quotient + 1) * waterGen - water + regrowth - 1) / regrowth, ticks);
+		water = (int)std::min<quint64>(water + regrowth * run, LevelMax);
+		ticks -= run;
+	}
+	return water;
+}
+
+// V food and stress of an unoccupied tile after ticks updates. Stress drops by one per
+// tick. V doesn't regrow while stress * stress lies between the growth and 2^31, those
+// ticks are skipped in one go, and it never drops, so a full tile stays full.
+void fastForwardFood(Level &food, Level &stress, int growth, quint64 ticks) {
+	int quietStress = 1;
+	while (quietStress * quietStress < growth) quietStress++;
+	int v = food;
+	int s = stress;
+	while (ticks > 0 && v < LevelMax) {
+		if (s == 0) {
+			v = (int)std::min<quint64>(v + growth * std::min<quint64>(ticks, LevelMax), LevelMax);
+			break;
+		}
+		if (s >= quietStress && s <= 46340) {
+			quint64 skip = std::min<quint64>(ticks, s - quietStress + 1);
+			s -= skip;
+			ticks -= skip;
+			continue;
+		}
+		v = std::min(v + foodRegrowth(growth, s), LevelMax);
+		s--;
+		ticks--;
+	}
+	food = v;
+	stress = ticks >= (quint64)s ? 0 : s - ticks;
+}
+#endif
+
+}
+
+// Same arithmetic as the EntityProperty operations in the scalar loop, on eight tiles
+// at a time in 32 bit lanes. The V food decay, (V / 10 * V / 10) / 10000, is always 0
+// as the product saturates at 65535, so the vector version leaves it out.
+void Map::updateTileLevels(int begin, int end) {
+	int i = begin;
+#ifdef __AVX2__
+	Level *water = (Level*)mWaterLevels.data();
+	Level *foodV = (Level*)mFoodLevels[(int)FoodType::V].data();
+	Level *foodM = (Level*)mFoodLevels[(int)FoodType::M].data();
+	Level *stress = (Level*)mStressLevels.data();
+	const quint8 *waterGenLevels = mWaterGenLevels.constData();
+	const quint32 *occupants = reinterpret_cast<const quint32*>(mOccupants.constData());
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i levelMax = _mm256_set1_epi32(std::numeric_limits<Level>::max());
+	const __m256i lowBits = _mm256_set1_epi32(0xFFFF);
+	for (; i + 8 <= end; i += 8) {
+		__m256i waterGen = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(waterGenLevels + i)));
+		// Null handles are 0
+		__m256i empty = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(occupants + i)), zero);
+
+		// water += waterGen - water / waterGen. The reciprocal gives the quotient or one
+		// more, which the product check corrects.
+		__m256i w = loadLevels(water + i);
+		__m256i quotient = _mm256_srli_epi32(_mm256_mullo_epi32(w, _mm256_loadu_si256((const __m256i*)(mWaterGenReciprocals.constData() + i))), 16);
+		__m256i tooLarge = _mm256_cmpgt_epi32(_mm256_mullo_epi32(quotient, waterGen), w);
+		quotient = _mm256_add_epi32(quotient, tooLarge);
+		__m256i regrowth = _mm256_max_epi32(_mm256_sub_epi32(waterGen, quotient), zero);
+		storeLevels(water + i, _mm256_min_epi32(_mm256_add_epi32(w, regrowth), levelMax));
+
+		// V += max(growth - stress * stress, 0), in wrapping int arithmetic and truncated
+		// to 16 bits like the conversion to EntityProperty
+		__m256i s = loadLevels(stress + i);
+		__m256i growth = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(mFoodGrowth.constData() + i)));
+		growth = _mm256_max_epi32(_mm256_sub_epi32(growth, _mm256_mullo_epi32(s, s)), zero);
+		growth = _mm256_and_si256(growth, lowBits);
+		__m256i v = loadLevels(foodV + i);
+		storeLevels(foodV + i, _mm256_min_epi32(_mm256_add_epi32(v, growth), levelMax));
+
+		__m256i stressed = _mm256_min_epi32(_mm256_add_epi32(s, _mm256_set1_epi32(3)), levelMax);
+		__m256i relaxed = _mm256_max_epi32(_mm256_sub_epi32(s, _mm256_set1_epi32(1)), zero);
+		storeLevels(stress + i, _mm256_blendv_epi8(stressed, relaxed, empty));
+
+		__m256i m = loadLevels(foodM + i);
+		storeLevels(foodM + i, _mm256_max_epi32(_mm256_sub_epi32(m, _mm256_set1_epi32(10)), zero));
+	}
+#endif
+	for (; i < end; i++) {
+		updateTileLevel(i);
+	}
+}
+
+void Map::updateTileLevel(int index) {
+	const quint8 waterGenLevel = mWaterGenLevels[index];
+	EntityProperty &water = mWaterLevels[index];
+	EntityProperty &foodV = mFoodLevels[(int)FoodType::V][index];
+	EntityProperty &stress = mStressLevels[index];
+	if (waterGenLevel) water += EntityProperty(waterGenLevel) - water / waterGenLevel;
+	foodV += foodRegrowth(mFoodGrowth[index], stress.value());
+	if (!mOccupants[index].isNull())
+		stress += 3;
+	else
+		stress -= 1;
+	foodV -= (foodV / 10 * foodV / 10) / 10000;
+	mFoodLevels[(int)FoodType::M][index] -= 10;
+}
+
+#ifdef LAZY_TILES
+Map::TileLevels Map::caughtUpLevels(int index) const {
+	// Tiles with an entity are updated every tick
+	assert(mOccupants[index].isNull());
+	const quint64 ticks = mTick - mUpdatedTicks[index];
+	TileLevels levels;
+	levels.mWaterLevel = fastForwardWater(mWaterLevels[index].value(), mWaterGenLevels[index], ticks);
+	Level food = mFoodLevels[(int)FoodType::V][index].value();
+	Level stress = mStressLevels[index].value();
+	fastForwardFood(food, stress, mFoodGrowth[index], ticks);
+	levels.mFoodLevels[(int)FoodType::V] = food;
+	levels.mStressLevel = stress;
+	Level foodM = mFoodLevels[(int)FoodType::M][index].value();
+	levels.mFoodLevels[(int)FoodType::M] = ticks >= (quint64)foodM / 10 + 1 ? 0 : foodM - (Level)ticks * 10;
+	return levels;
+}
+
+void Map::catchUpMissedTicks(int index) {
+	TileLevels levels = caughtUpLevels(index);
+	for (int food = 0; food < (int)FoodType::MaxFoodType; food++) {
+		mFoodLevels[food][index] = levels.mFoodLevels[food];
+	}
+	mWaterLevels[index] = levels.mWaterLevel;
+	mStressLevels[index] = levels.mStressLevel;
+	mUpdatedTicks[index] = mTick;
+}
+#endif
+
+void Map::resizeTiles() {
+#ifdef BLOCKED_TILES
+	mBlocksPerRow = (mWidth + BlockSize - 1) / BlockSize;
+	const int blockRows = (mHeight + BlockSize - 1) / BlockSize;
+	// Blocks at the right and bottom edges are padded, the padding is never used
+	const int count = mBlocksPerRow * blockRows * BlockSize * BlockSize;
+#else
+	const int count = mWidth * mHeight;
+#endif
+	mFoodGenLevels.fill(0, count);
+	mWaterGenLevels.fill(0, count);
+	mHeats.fill(0, count);
+	mOccupants.fill(EntityHandle(), count);
+	for (QVector<EntityProperty> &levels : mFoodLevels) {
+		levels.fill(EntityProperty(), count);
+	}
+	mWaterLevels.fill(100, count);
+	mStressLevels.fill(EntityProperty(), count);
+#ifdef LAZY_TILES
+	mUpdatedTicks.fill(mTick, count);
+#endif
+}
+
+void Map::initializeTileConstants() {
+	const int count = mOccupants.size();
+	mFoodGrowth.resize(count);
+	mWaterGenReciprocals.resize(count);
+	for (int i = 0; i < count; i++) {
+		mFoodGrowth[i] = (int)sqrt(mFoodGenLevels[i] * 10);
+		// Tiles with a water generation level of 0 don't regrow water. The reciprocal of 0
+		// makes the vector update leave their water as it is, like the scalar one.
+		mWaterGenReciprocals[i] = mWaterGenLevels[i] ? (1u << 16) / mWaterGenLevels[i] + 1 : 0;
+	}
+#ifdef BLOCKED_TILES
+	// Snapshots are row-major, so the planes can't be shared with them
+	const QVector<quint8> *planes[3] = {&mFoodGenLevels, &mWaterGenLevels, &mHeats};
+	for (int layer = 0; layer < 3; layer++) {
+		QVector<quint8> &staticLayer = mStaticLayers[layer];
+		staticLayer.resize(mWidth * mHeight);
+		for (int y = 0; y < mHeight; y++) {
+			for (int x = 0; x < mWidth; x++) {
+				staticLayer[x + mWidth * y] = (*planes[layer])[tileIndex(Position(x, y))];
+			}
+		}
+	}
+#else
+	mStaticLayers[0] = mFoodGenLevels;
+	mStaticLayers[1] = mWaterGenLevels;
+	mStaticLayers[2] = mHeats;
+#endif
+}
+
 const QList<Entity*> &Map::entities() const {
 	return mEntities;
 }
 
+#ifdef DECISION_MEMO
+DecisionMemoStatistics Map::takeMemoStatistics() {
+	return mGenomePool.takeMemoStatistics();
+}
+#endif
+
 void Map::deletePass() {
-	for (QList<Entity*>::Iterator i = mEntities.begin(); i != mEntities.end();) {
-		if ((*i)->deletePass()) {
-			tile((*i)->position()).mFoodLevels[(int)FoodType::M] += (*i)->energy() * 40 + 30 * sqrt((*i)->lifeTime());
-			tile((*i)->position()).mEntity = 0;
-			delete *i;
-			i = mEntities.erase(i);
+	markDeadEntities(0, mEntities.size());
+	removeDeadEntities();
+}
+
+void Map::markDeadEntities(int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		Entity *entity = mEntities.at(i);
+		if (entity->deletePass()) {
+			foodLevel(entity->position(), FoodType::M) += entity->energy() * 40 + 30 * sqrt(entity->lifeTime());
+			mOccupants[tileIndex(entity->position())] = EntityHandle();
+		}
+	}
+}
+
+void Map::removeDeadEntities() {
+	int size = mEntities.size();
+#ifdef SWAP_REMOVE_DEAD_ENTITIES
+	// Every dead entity is replaced by the last one, walking from the front
+	for (int i = 0; i < size;) {
+		if (mEntities.at(i)->isDead()) {
+			mEntityPool.destroy(mEntities.at(i));
+			size--;
+			mEntities[i] = mEntities.at(size);
+		}
+		else {
+			i++;
+		}
+	}
+#else
+	int kept = 0;
+	for (int i = 0; i < size; i++) {
+		Entity *entity = mEntities.at(i);
+		if (entity->isDead()) {
+			mEntityPool.destroy(entity);
 		}
 		else {
-			++i;
+			mEntities[kept++] = entity;
+		}
+	}
+	size = kept;
+#endif
+	mEntities.erase(mEntities.begin() + size, mEntities.end());
+
+	mGenomePool.collectGarbage();
+}
+
+void Map::sortEntities() {
+	// No two entities share a tile, so the order doesn't depend on the sort algorithm
+	std::sort(mEntities.begin(), mEntities.end(), [this](const Entity *a, const Entity *b) {
+		return tileIndex(a->position()) < tileIndex(b->position());
+	});
+}
+
+void Map::orderNewEntities() {
+	auto bySlot = [](const Entity *a, const Entity *b) {
+		return a->handle().index() < b->handle().index();
+	};
+	const int sorted = std::is_sorted_until(mEntities.begin(), mEntities.end(), bySlot) - mEntities.begin();
+	if (sorted == mEntities.size()) return;
+
+	// Only the new entities at the end are out of order. They are sorted on their own and
+	// merged in from the back.
+	mNewEntities.resize(mEntities.size() - sorted);
+	std::copy(mEntities.begin() + sorted, mEntities.end(), mNewEntities.begin());
+	std::sort(mNewEntities.begin(), mNewEntities.end(), bySlot);
+	int write = mEntities.size() - 1;
+	int old = sorted - 1;
+	for (int i = mNewEntities.size() - 1; i >= 0; i--) {
+		while (old >= 0 && bySlot(mNewEntities.at(i), mEntities.at(old))) {
+			mEntities[write--] = mEntities.at(old--);
 		}
+		mEntities[write--] = mNewEntities.at(i);
 	}
 }
 
-
 void Map::randomFillMapWithEntities(int promil) {
-	qsrand(12314);
-
 	std::uniform_int_distribution<> dis(0, 999);
 	for (int y = 0; y < mHeight; y++) {
 		for (int x = 0; x < mWidth; x++) {
-			if (dis(mRandomGenerator) <= promil) {
-				Entity *entity = new Entity();
-				entity->setByteCode(mDefaultByteCode);
+			if (dis(mRandom) <= promil) {
+				Entity *entity = mEntityPool.create();
+				entity->setGenome(mDefaultGenome);
 				addEntity(entity, Position(x, y));
 			}
 		}
@@ -231,12 +577,14 @@ Entity *Map::createAndRandomPlaceEntity() {
 	}
 	else {
 		std::uniform_int_distribution<> baseDist(0, mEntities.size() - 1);
-		Entity *baseEntity = mEntities.at(baseDist(mRandomGenerator));
-		entity = createNewEntity(baseEntity);
+		Entity *baseEntity = mEntities.at(baseDist(mRandom));
+		entity = createNewEntity(baseEntity, mRandom);
 	}
-	Position pos = findValidLocation(Position(qrand() % mWidth, qrand() % mHeight), 10);
+	const int x = mRandom() % mWidth;
+	const int y = mRandom() % mHeight;
+	Position pos = findValidLocation(Position(x, y), 10);
 	if (pos.isErrorValue()) {
-		delete entity;
+		mEntityPool.destroy(entity);
 		return 0;
 	}
 
@@ -244,33 +592,47 @@ Entity *Map::createAndRandomPlaceEntity() {
 	return entity;
 }
 
-Entity *Map::createNewEntity(Entity *baseEntity) {
+Entity *Map::createNewEntity(Entity *baseEntity, RandomStream &random) {
+	Entity *newEntity = reserveEntity();
+	buildNewEntity(newEntity, baseEntity, random);
+	return newEntity;
+}
+
+Entity *Map::reserveEntity() {
+	return mEntityPool.create();
+}
+
+void Map::buildNewEntity(Entity *newEntity, Entity *baseEntity, RandomStream &random) {
 	QVector<Instruction> byteCode = baseEntity->byteCode();
-	while (qrand() % 10 < 5) {
-		int mod = qrand() % 10;
+	bool mutated = false;
+	while (random() % 10 < 5) {
+		mutated = true;
+		int mod = random() % 10;
 		if (mod < 5) {
-			OpCode opCode = (OpCode)(qrand() % (int)OpCode::MaxOpCode);
+			OpCode opCode = (OpCode)(random() % (int)OpCode::MaxOpCode);
+			// Drawn one after another, the order arguments are evaluated in is unspecified
+			int index = random() % (byteCode.size()  + 1);
 			if (opCode == OpCode::Jump || opCode == OpCode::ConditionalJump) {
-				byteCode.insert(qrand() % (byteCode.size()  + 1), Instruction(opCode, qrand() % 10));
+				byteCode.insert(index, Instruction(opCode, random() % 10));
 			}
 			else {
-				byteCode.insert(qrand() % (byteCode.size()  + 1), Instruction(opCode, qrand()));
+				byteCode.insert(index, Instruction(opCode, random()));
 			}
 
 		}
 		else if (mod < 9 && byteCode.size() > 10) {
-			byteCode.removeAt(qrand() % byteCode.size());
+			byteCode.removeAt(random() % byteCode.size());
 		}
 		else {
-			byteCode[qrand() % (byteCode.size())].mParam = qrand();
+			int index = random() % (byteCode.size());
+			byteCode[index].mParam = random();
 		}
 	}
-	Entity *newEntity = new Entity();
 	newEntity->maxEnergy() = baseEntity->maxEnergy();
 	newEntity->maxHealth() = baseEntity->maxHealth();
 	newEntity->setHydrationAdaption(baseEntity->hydrationAdaption());
 	newEntity->setFoodLevelAdaption(baseEntity->foodLevelAdaption());
-	switch (qrand() % 30) {
+	switch (random() % 30) {
 		case 1:
 			newEntity->maxHealth() += 1;
 			break;
@@ -300,33 +662,35 @@ Entity *Map::createNewEntity(Entity *baseEntity) {
 	}
 
 	newEntity->setGeneration(baseEntity->generation() + 1);
-	newEntity->setByteCode(byteCode);
-	return newEntity;
+	if (mutated) {
+		newEntity->setGenome(mGenomePool.intern(byteCode));
+	}
+	else {
+		newEntity->setGenome(baseEntity->genome());
+	}
 }
 
-Entity *Map::createAndPlaceEntity(Entity *baseEntity) {
-	Entity *e = createNewEntity(baseEntity);
-	if (!e) return 0;
-	Position p = findValidLocation(baseEntity->position(), 3);
+bool Map::placeChild(Entity *child, const Entity *parent) {
+	Position p = findValidLocation(parent->position(), 3);
 	if (!p.isErrorValue()) {
-		addEntity(e, p);
-		return e;
+		addEntity(child, p);
+		return true;
 	}
 	else {
-		delete e;
-		return 0;
+		mEntityPool.destroy(child);
+		return false;
 	}
 }
 
 
 Entity *Map::createDefaultEntity() {
-	Entity *entity = new Entity();
-	entity->setByteCode(mDefaultByteCode);
+	Entity *entity = mEntityPool.create();
+	entity->setGenome(mDefaultGenome);
 	return entity;
 }
 
 
-static const int VERSION_NUMBER = 1;
+static const int VERSION_NUMBER = 2;
 void Map::save(const QString &path) {
 	QFile file(path);
 	if (!file.open(QFile::WriteOnly)) {
@@ -338,7 +702,23 @@ void Map::save(const QString &path) {
 	out << mWidth;
 	out << mHeight;
 	out << mTick;
-	out << mTiles;
+	out << mSeed;
+	out << mRandom.counter();
+	out << mNextEntityId;
+	// Tiles are saved in row-major order whatever order they are stored in
+	out << (quint32)(mWidth * mHeight);
+	for (int p = 0; p < mWidth * mHeight; p++) {
+		const int i = tileIndex(Position(p % mWidth, p / mWidth));
+		catchUp(i);
+		for (int food = 0; food < (int)FoodType::MaxFoodType; food++) {
+			out << mFoodLevels[food][i];
+		}
+		out << mStressLevels[i];
+		out << mWaterLevels[i];
+		out << mFoodGenLevels[i];
+		out << mWaterGenLevels[i];
+		out << mHeats[i];
+	}
 
 	out << mEntities.size();
 	for (Entity *entity : mEntities) {
@@ -358,14 +738,37 @@ void Map::load(const QString &path) {
 	in >> mWidth;
 	in >> mHeight;
 	in >> mTick;
-	in >> mTiles;
+	if (versionNumber >= 2) {
+		quint64 randomCounter;
+		in >> mSeed;
+		in >> randomCounter;
+		in >> mNextEntityId;
+		mRandom = RandomStream(mSeed, randomCounter);
+	}
+	quint32 tileCount;
+	in >> tileCount;
+	assert((int)tileCount == mWidth * mHeight);
+	resizeTiles();
+	for (int p = 0; p < (int)tileCount; p++) {
+		const int i = tileIndex(Position(p % mWidth, p / mWidth));
+		for (int food = 0; food < (int)FoodType::MaxFoodType; food++) {
+			in >> mFoodLevels[food][i];
+		}
+		in >> mStressLevels[i];
+		in >> mWaterLevels[i];
+		in >> mFoodGenLevels[i];
+		in >> mWaterGenLevels[i];
+		in >> mHeats[i];
+	}
+	initializeTileConstants();
 	int entitiesSize;
 	in >> entitiesSize;
 	for (int i = 0; i < entitiesSize; i++) {
-		Entity *newEntity = new Entity();
-		newEntity->load(in, VERSION_NUMBER);
+		Entity *newEntity = mEntityPool.create();
+		newEntity->load(in, versionNumber, mGenomePool);
+		if (versionNumber < 2) newEntity->setId(mNextEntityId++);
 		mEntities.append(newEntity);
-		tile(newEntity->position()).mEntity = newEntity;
+		mOccupants[tileIndex(newEntity->position())] = newEntity->handle();
 	}
 
 	mDrawBuffers[0] = QImage(mWidth, mHeight, QImage::Format_RGB32);
@@ -377,6 +780,10 @@ quint64 Map::tick() const {
 	return mTick;
 }
 
+quint64 Map::seed() const {
+	return mSeed;
+}
+
 void Map::setDrawModeR(int mode) {
 	mDrawModes[0] = mode;
 }
@@ -440,43 +847,5 @@ void Map::initializeDefaultByteCode() {
 	byteCode.append(Instruction(OpCode::ConditionalJump, 1));
 	byteCode.append(Instruction(OpCode::Reproduce, 0));
 
-	mDefaultByteCode = byteCode;
-}
-
-
-
-
-
-
-
-Tile::Tile() :
-	mWaterLevel(100),
-	mEntity(0) {
-
-}
-
-
-QDataStream &operator <<(QDataStream &out, const Tile &tile) {
-	for (int i = 0; i < (int)FoodType::MaxFoodType; i++) {
-		out << tile.mFoodLevels[i];
-	}
-	out << tile.mStressLevel;
-	out << tile.mWaterLevel;
-	out << tile.mFoodGenLevel;
-	out << tile.mWaterGenLevel;
-	out << tile.mHeat;
-	return out;
-}
-
-
-QDataStream &operator >>(QDataStream &in, Tile &tile) {
-	for (int i = 0; i < (int)FoodType::MaxFoodType; i++) {
-		in >> tile.mFoodLevels[i];
-	}
-	in >> tile.mStressLevel;
-	in >> tile.mWaterLevel;
-	in >> tile.mFoodGenLevel;
-	in >> tile.mWaterGenLevel;
-	in >> tile.mHeat;
-	return in;
+	mDefaultGenome = mGenomePool.intern(byteCode);
 }
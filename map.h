@@ -4,27 +4,21 @@
 #include <QVector>
 #include "position.h"
 #include "enums.h"
-#include <random>
 #include "entity.h"
+#include "entitypool.h"
+#include "randomstream.h"
+#include "genomepool.h"
 #include <QImage>
 #include <QObject>
+#include "mapsnapshot.h"
 
 
 class QPainter;
-struct Tile {
-	Tile();
-
-	EntityProperty foodLevel(FoodType type) const { return mFoodLevels[(int)type]; }
-	EntityProperty mFoodLevels[(int)FoodType::MaxFoodType];
-	EntityProperty mWaterLevel;
-	EntityProperty mStressLevel;
-	quint8 mWaterGenLevel;
-	quint8 mFoodGenLevel;
-	quint8 mHeat;
-	Entity *mEntity;
-
-};
 
+// Every field of the tiles is kept in a plane of its own, so sensing, movement, the level
+// update and drawing only read the bytes they use. The planes are in row-major tile order,
+// or with BLOCKED_TILES in blocks of BlockSize x BlockSize tiles, so the neighbours above
+// and below a tile are mostly on the same few cache lines too.
 class Map {
 	public:
 		Map();
@@ -32,8 +26,14 @@ class Map {
 		~Map();
 		int width() const;
 		int height() const;
-		Tile &tile(Position position);
-		const Tile &tile(Position position) const;
+		quint8 foodGenLevel(Position position) const;
+		quint8 waterGenLevel(Position position) const;
+		quint8 heat(Position position) const;
+		EntityProperty &foodLevel(Position position, FoodType type);
+		EntityProperty foodLevel(Position position, FoodType type) const;
+		EntityProperty &waterLevel(Position position);
+		EntityProperty waterLevel(Position position) const;
+		EntityProperty stressLevel(Position position) const;
 		bool isMovableLocation(Position target) const;
 		bool move(Entity *entity, Position target);
 		Position findValidLocation(Position nearPos, int maxRange);
@@ -42,26 +42,71 @@ class Map {
 		bool addEntity(Entity *entity, Position pos);
 
 		QImage draw();
+		// Copies the channels the current draw modes need
+		void snapshot(MapSnapshot &snapshot) const;
 
-		void updateFoodLevels();
+		// Regrows and decays the levels of the rows [beginRow, endRow). Disjoint bands of
+		// rows can be updated concurrently.
+		void updateFoodLevels(int beginRow, int endRow);
+#ifdef LAZY_TILES
+		// Regrows and decays the levels of the tiles the entities [begin, end) stand on.
+		// Replaces updateFoodLevels, the other tiles catch up when they are accessed.
+		void updateOccupiedFoodLevels(int begin, int end);
+#endif
+		// Ends the tick once all rows are updated
+		void advanceTick();
 		const QList<Entity *> &entities() const;
+#ifdef DECISION_MEMO
+		// See GenomePool::takeMemoStatistics
+		DecisionMemoStatistics takeMemoStatistics();
+#endif
+		// markDeadEntities over all entities followed by removeDeadEntities
 		void deletePass();
+		// Runs deletePass of the entities [begin, end). The dead ones leave their food
+		// and are taken off their tiles. Disjoint ranges can run concurrently, every
+		// entity only touches its own tile.
+		void markDeadEntities(int begin, int end);
+		// Destroys the dead entities and compacts the entity list in one pass
+		void removeDeadEntities();
+		// Orders the entities by the tiles they stand on, so entities updated one after
+		// the other read neighbouring tiles. Entities move and children are appended, so
+		// the order decays and is restored every EntitySortInterval ticks.
+		void sortEntities();
+		static const int EntitySortInterval = 32;
+		// Moves the entities added since the last call to their place in slot order. The
+		// pool packs the entities at its front, so walking the entity list then walks the
+		// pool's memory front to back. The other entities have to be in slot order
+		// already, which removeDeadEntities only keeps without SWAP_REMOVE_DEAD_ENTITIES.
+		void orderNewEntities();
 		void randomFillMapWithEntities(int promil);
 
 
 		Entity *createAndRandomPlaceEntity();
-		Entity *createNewEntity(Entity *baseEntity);
+		// reserveEntity followed by buildNewEntity
+		Entity *createNewEntity(Entity *baseEntity, RandomStream &random);
+		// Empty entity in the lowest free slot of the pool. Entities are reserved one
+		// after another in a fixed order, so their slots don't depend on the threads.
+		Entity *reserveEntity();
+		// Makes a reserved entity a child of baseEntity. Thread safe as long as nobody
+		// else uses random.
+		void buildNewEntity(Entity *newEntity, Entity *baseEntity, RandomStream &random);
 
-		Entity *createAndPlaceEntity(Entity *baseEntity);
+		// Places a child built by buildNewEntity next to its parent, deletes it if
+		// there is no room. Returns false in that case.
+		bool placeChild(Entity *child, const Entity *parent);
 		Entity *createDefaultEntity();
 
 
 
 		Entity *entity(Position pos) const;
+		// 0 if the entity was destroyed
+		Entity *entity(EntityHandle handle) const;
 
 		void save(const QString &path);
 		void load(const QString &path);
 		quint64 tick() const;
+		// Seed of every random number drawn in this map
+		quint64 seed() const;
 
 		void setDrawModeR(int mode);
 		void setDrawModeG(int mode);
@@ -69,21 +114,83 @@ class Map {
 		bool noDraw() const;
 	private:
 		void initializeDefaultByteCode();
+		void resizeTiles();
+		// Derives the per tile constants of updateFoodLevels from the generation levels
+		void initializeTileConstants();
+		void updateTileLevels(int begin, int end);
+		void updateTileLevel(int index);
+		int tileIndex(Position position) const;
+		EntityProperty foodLevelAt(int index, FoodType type) const;
+		EntityProperty waterLevelAt(int index) const;
+		EntityProperty stressLevelAt(int index) const;
+		// Brings the levels of a tile up to date before they are written
+		void catchUp(int index);
+#ifdef LAZY_TILES
+		struct TileLevels {
+			EntityProperty mFoodLevels[(int)FoodType::MaxFoodType];
+			EntityProperty mWaterLevel;
+			EntityProperty mStressLevel;
+		};
+
+		// Levels of an unoccupied tile after the ticks it missed
+		TileLevels caughtUpLevels(int index) const;
+		void catchUpMissedTicks(int index);
+#endif
 
 
 		quint64 mTick;
 		int mWidth;
 		int mHeight;
-		QVector<Tile> mTiles;
+#ifdef BLOCKED_TILES
+		static const int BlockBits = 3;
+		static const int BlockSize = 1 << BlockBits;
+		int mBlocksPerRow;
+#endif
+		// Set from the map image and never changed
+		QVector<quint8> mFoodGenLevels;
+		QVector<quint8> mWaterGenLevels;
+		QVector<quint8> mHeats;
+		// Row-major channels of the draw modes 5 to 7 that snapshots share. The planes
+		// themselves, unless the tiles are blocked.
+		QVector<quint8> mStaticLayers[3];
+		// Handle of the entity standing on each tile, null if the tile is empty
+		QVector<EntityHandle> mOccupants;
+		// Levels that change every tick, one contiguous plane per field in tile order
+		QVector<EntityProperty> mFoodLevels[(int)FoodType::MaxFoodType];
+		QVector<EntityProperty> mWaterLevels;
+		QVector<EntityProperty> mStressLevels;
+		// (int)sqrt(food generation level * 10), the V food regrowth of an unstressed tile
+		QVector<quint16> mFoodGrowth;
+		// 2^16 / water generation level + 1, to divide the water level by the generation level
+		// with a multiplication
+		QVector<quint32> mWaterGenReciprocals;
+#ifdef LAZY_TILES
+		// Tick the levels of each tile are up to date for. Occupied tiles are updated
+		// every tick, the others only catch up, in one go, once they are accessed. Reads
+		// compute the current levels without storing them, so concurrent readers are
+		// fine. Writes are limited to occupied tiles and the targets of moves.
+		QVector<quint64> mUpdatedTicks;
+#endif
+		EntityPool mEntityPool;
+		// In slot order once orderNewEntities ran, unless SORT_ENTITIES orders them by tile
+		// or SWAP_REMOVE_DEAD_ENTITIES mixes them up
 		QList<Entity*> mEntities;
-		std::mt19937 mRandomGenerator;
+		// Entities orderNewEntities merges into the list
+		QVector<Entity*> mNewEntities;
+		quint64 mSeed;
+		// Random numbers drawn by the map itself, to fill and repopulate it
+		RandomStream mRandom;
+		quint64 mNextEntityId;
 
 		int mDrawModes[3];
 		QImage mDrawBuffers[2];
 		int mCurrentBuffer;
+		MapSnapshot mDrawSnapshot;
+		StaticFrameCache mStaticFrameCache;
 
 
-		QVector<Instruction> mDefaultByteCode;
+		GenomePool mGenomePool;
+		GenomeHandle mDefaultGenome;
 
 
 
@@ -95,9 +202,84 @@ inline bool Map::isPositionOnMap(Position position) const {
 
 inline Entity *Map::entity(Position pos) const {
 	if (!isPositionOnMap(pos)) return 0;
-	return tile(pos).mEntity;
+	return mEntityPool.get(mOccupants[tileIndex(pos)]);
+}
+
+inline Entity *Map::entity(EntityHandle handle) const {
+	return mEntityPool.get(handle);
+}
+
+inline int Map::tileIndex(Position position) const {
+#ifdef BLOCKED_TILES
+	const int block = (position.y >> BlockBits) * mBlocksPerRow + (position.x >> BlockBits);
+	return block << (2 * BlockBits) | (position.y & (BlockSize - 1)) << BlockBits | (position.x & (BlockSize - 1));
+#else
+	return position.x + mWidth * position.y;
+#endif
+}
+
+inline quint8 Map::foodGenLevel(Position position) const {
+	return mFoodGenLevels[tileIndex(position)];
+}
+
+inline quint8 Map::waterGenLevel(Position position) const {
+	return mWaterGenLevels[tileIndex(position)];
+}
+
+inline quint8 Map::heat(Position position) const {
+	return mHeats[tileIndex(position)];
+}
+
+inline void Map::catchUp(int index) {
+#ifdef LAZY_TILES
+	if (mUpdatedTicks[index] != mTick) catchUpMissedTicks(index);
+#else
+	Q_UNUSED(index);
+#endif
 }
 
-QDataStream &operator << (QDataStream &out, const Tile &tile);
-QDataStream &operator >> (QDataStream &in, Tile &tile);
+inline EntityProperty Map::foodLevelAt(int index, FoodType type) const {
+#ifdef LAZY_TILES
+	if (mUpdatedTicks[index] != mTick) return caughtUpLevels(index).mFoodLevels[(int)type];
+#endif
+	return mFoodLevels[(int)type][index];
+}
+
+inline EntityProperty Map::waterLevelAt(int index) const {
+#ifdef LAZY_TILES
+	if (mUpdatedTicks[index] != mTick) return caughtUpLevels(index).mWaterLevel;
+#endif
+	return mWaterLevels[index];
+}
+
+inline EntityProperty Map::stressLevelAt(int index) const {
+#ifdef LAZY_TILES
+	if (mUpdatedTicks[index] != mTick) return caughtUpLevels(index).mStressLevel;
+#endif
+	return mStressLevels[index];
+}
+
+inline EntityProperty &Map::foodLevel(Position position, FoodType type) {
+	const int index = tileIndex(position);
+	catchUp(index);
+	return mFoodLevels[(int)type][index];
+}
+
+inline EntityProperty Map::foodLevel(Position position, FoodType type) const {
+	return foodLevelAt(tileIndex(position), type);
+}
+
+inline EntityProperty &Map::waterLevel(Position position) {
+	const int index = tileIndex(position);
+	catchUp(index);
+	return mWaterLevels[index];
+}
+
+inline EntityProperty Map::waterLevel(Position position) const {
+	return waterLevelAt(tileIndex(position));
+}
+
+inline EntityProperty Map::stressLevel(Position position) const {
+	return stressLevelAt(tileIndex(position));
+}
 #endif // MAP_H
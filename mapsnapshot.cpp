@@ -0,0 +1,171 @@
+#include "mapsnapshot.h"
+#include <limits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+typedef EntityProperty::ValueType Level;
+
+enum ChannelKind {
+	NoChannel,
+	ValueChannel,
+	LevelChannel,
+	ChannelKindCount
+};
+
+ChannelKind channelKind(int mode) {
+	if (mode <= 0 || mode >= MapSnapshot::DrawModeCount) return NoChannel;
+	return MapSnapshot::isLevelMode(mode) ? LevelChannel : ValueChannel;
+}
+
+const void *channelData(const MapSnapshot &snapshot, int channel) {
+	const int mode = snapshot.mDrawModes[channel];
+	switch (channelKind(mode)) {
+		case ValueChannel:
+			return snapshot.mValues[mode].constData();
+		case LevelChannel:
+			return snapshot.mLevels[mode].constData();
+		default:
+			return 0;
+	}
+}
+
+// Reads the values of one kind of channel, one pixel at a time and, with AVX2, eight at
+// a time in 32 bit lanes
+template <int Kind>
+struct Channel;
+
+template <>
+struct Channel<NoChannel> {
+	static quint32 at(const void *, const quint8 *, int) { return 0; }
+#ifdef __AVX2__
+	static __m256i at8(const void *, const quint8 *, int) { return _mm256_setzero_si256(); }
+#endif
+};
+
+template <>
+struct Channel<ValueChannel> {
+	static quint32 at(const void *data, const quint8 *, int i) { return ((const quint8*)data)[i]; }
+#ifdef __AVX2__
+	static __m256i at8(const void *data, const quint8 *, int i) {
+		return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)((const quint8*)data + i)));
+	}
+#endif
+};
+
+template <>
+struct Channel<LevelChannel> {
+	static quint32 at(const void *data, const quint8 *sqrtTable, int i) { return sqrtTable[((const Level*)data)[i]]; }
+#ifdef __AVX2__
+	// Gathers four bytes from the table per level and keeps the first
+	static __m256i at8(const void *data, const quint8 *sqrtTable, int i) {
+		__m256i levels = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)((const Level*)data + i)));
+		__m256i roots = _mm256_i32gather_epi32((const int*)sqrtTable, levels, 1);
+		return _mm256_and_si256(roots, _mm256_set1_epi32(0xFF));
+	}
+#endif
+};
+
+template <int R, int G, int B>
+void drawKernel(const MapSnapshot &snapshot, uchar *bits, int bytesPerLine, int beginRow, int endRow) {
+	const void *red = channelData(snapshot, 0);
+	const void *green = channelData(snapshot, 1);
+	const void *blue = channelData(snapshot, 2);
+	const quint8 *sqrtTable = MapSnapshot::sqrtTable();
+	const int width = snapshot.mWidth;
+	for (int y = beginRow; y < endRow; y++) {
+		quint32 *line = (quint32*)(bits + (qptrdiff)y * bytesPerLine);
+		const int offset = y * width;
+		int x = 0;
+#ifdef __AVX2__
+		const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+		for (; x + 8 <= width; x += 8) {
+			__m256i pixels = _mm256_or_si256(alpha, _mm256_slli_epi32(Channel<R>::at8(red, sqrtTable, offset + x), 16));
+			pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(Channel<G>::at8(green, sqrtTable, offset + x), 8));
+			pixels = _mm256_or_si256(pixels, Channel<B>::at8(blue, sqrtTable, offset + x));
+			_mm256_storeu_si256((__m256i*)(line + x), pixels);
+		}
+#endif
+		for (; x < width; x++) {
+			line[x] = 0xFF000000 | Channel<R>::at(red, sqrtTable, offset + x) << 16
+					| Channel<G>::at(green, sqrtTable, offset + x) << 8
+					| Channel<B>::at(blue, sqrtTable, offset + x);
+		}
+	}
+}
+
+// Indexed by the channel kinds of red, green and blue
+#define KERNELS(R, G) { &drawKernel<R, G, NoChannel>, &drawKernel<R, G, ValueChannel>, &drawKernel<R, G, LevelChannel> }
+const MapSnapshot::Kernel kernels[ChannelKindCount][ChannelKindCount][ChannelKindCount] = {
+	{ KERNELS(NoChannel, NoChannel), KERNELS(NoChannel, ValueChannel), KERNELS(NoChannel, LevelChannel) },
+	{ KERNELS(ValueChannel, NoChannel), KERNELS(ValueChannel, ValueChannel), KERNELS(ValueChannel, LevelChannel) },
+	{ KERNELS(LevelChannel, NoChannel), KERNELS(LevelChannel, ValueChannel), KERNELS(LevelChannel, LevelChannel) }
+};
+#undef KERNELS
+
+QVector<quint8> createSqrtTable() {
+	const int levels = std::numeric_limits<Level>::max() + 1;
+	QVector<quint8> table(levels + 3, 0);
+	for (int level = 0; level < levels; level++) {
+		table[level] = EntityProperty(level).sqrt().value();
+	}
+	return table;
+}
+
+}
+
+MapSnapshot::MapSnapshot() :
+	mWidth(0),
+	mHeight(0),
+	mKernel(kernels[NoChannel][NoChannel][NoChannel]) {
+	mDrawModes[0] = mDrawModes[1] = mDrawModes[2] = 0;
+}
+
+bool MapSnapshot::noDraw() const {
+	return mDrawModes[0] == 0 && mDrawModes[1] == 0 && mDrawModes[2] == 0;
+}
+
+bool MapSnapshot::isLevelMode(int mode) {
+	return mode >= 2 && mode <= 4;
+}
+
+bool MapSnapshot::isStaticMode(int mode) {
+	return mode >= 5 && mode <= 7;
+}
+
+bool MapSnapshot::isStatic() const {
+	for (int i = 0; i < 3; i++) {
+		if (mDrawModes[i] != 0 && !isStaticMode(mDrawModes[i])) return false;
+	}
+	return true;
+}
+
+const quint8 *MapSnapshot::sqrtTable() {
+	static const QVector<quint8> table = createSqrtTable();
+	return table.constData();
+}
+
+void MapSnapshot::selectKernel() {
+	mKernel = kernels[channelKind(mDrawModes[0])][channelKind(mDrawModes[1])][channelKind(mDrawModes[2])];
+}
+
+QImage StaticFrameCache::find(const MapSnapshot &snapshot) const {
+	if (mFrame.isNull()) return QImage();
+	for (int i = 0; i < 3; i++) {
+		const int mode = snapshot.mDrawModes[i];
+		if (mode != mDrawModes[i]) return QImage();
+		if (mode != 0 && snapshot.mValues[mode].constData() != mChannels[i].constData()) return QImage();
+	}
+	return mFrame;
+}
+
+void StaticFrameCache::insert(const MapSnapshot &snapshot, const QImage &frame) {
+	for (int i = 0; i < 3; i++) {
+		const int mode = snapshot.mDrawModes[i];
+		mDrawModes[i] = mode;
+		mChannels[i] = mode != 0 ? snapshot.mValues[mode] : QVector<quint8>();
+	}
+	mFrame = frame;
+}
@@ -0,0 +1,66 @@
+#ifndef MAPSNAPSHOT_H
+#define MAPSNAPSHOT_H
+#include <QVector>
+#include <QImage>
+#include "entityproperty.h"
+
+// The channels of a map a frame is drawn from, taken at a tick boundary so the frame can
+// be drawn while the simulation goes on. Only the channels of the draw modes in use are
+// filled in. The buffers are kept from one snapshot to the next.
+//
+// Every colour channel is one of three kinds: empty, a value copied as it is, or a level
+// drawn as its square root. Frames are drawn by a kernel specialised for the kinds of the
+// three channels, picked once per snapshot, so the loop over the pixels has no branches.
+//
+// Modes 5 to 7 never change after the map is created or loaded. Their channels are
+// shared with the planes the map keeps for them instead of being copied.
+struct MapSnapshot {
+	static const int DrawModeCount = 9;
+
+	typedef void (*Kernel)(const MapSnapshot &snapshot, uchar *bits, int bytesPerLine, int beginRow, int endRow);
+
+	MapSnapshot();
+	bool noDraw() const;
+	// Modes 2 to 4, V food, M food and water, are drawn as the square root of the level
+	static bool isLevelMode(int mode);
+	// Modes 5 to 7, food generation, water generation and heat, never change
+	static bool isStaticMode(int mode);
+	// True if every channel is empty or drawn from a static mode
+	bool isStatic() const;
+	// EntityProperty::sqrt of every level, padded so four bytes can be read at any level
+	static const quint8 *sqrtTable();
+
+	// Picks the kernel for the current draw modes
+	void selectKernel();
+	// Draws the rows [beginRow, endRow) into RGB32 pixels. Disjoint bands of rows can
+	// be drawn concurrently.
+	void draw(uchar *bits, int bytesPerLine, int beginRow, int endRow) const;
+
+	int mWidth;
+	int mHeight;
+	int mDrawModes[3];
+	QVector<EntityProperty> mLevels[DrawModeCount];
+	// Channel values of the modes that aren't level modes
+	QVector<quint8> mValues[DrawModeCount];
+	Kernel mKernel;
+};
+
+// The last frame drawn only from static channels. It stays valid as long as the snapshot
+// is given the same static planes, which can't be freed and reused while the cache holds
+// on to them.
+class StaticFrameCache {
+	public:
+		// Cached frame for the snapshot's draw modes, a null image if there is none
+		QImage find(const MapSnapshot &snapshot) const;
+		void insert(const MapSnapshot &snapshot, const QImage &frame);
+	private:
+		int mDrawModes[3];
+		QVector<quint8> mChannels[3];
+		QImage mFrame;
+};
+
+inline void MapSnapshot::draw(uchar *bits, int bytesPerLine, int beginRow, int endRow) const {
+	mKernel(*this, bits, bytesPerLine, beginRow, endRow);
+}
+
+#endif // MAPSNAPSHOT_H
@@ -0,0 +1,130 @@
+#include "program.h"
+#include "entity.h"
+#include <algorithm>
+
+namespace {
+struct SuperInstruction {
+	OpCode mOpCode;
+	int mLength;
+	OpCode mSequence[5];
+};
+
+// Most executed straight line op code sequences in populations evolved from
+// Map::initializeDefaultByteCode, longest first. The first match is used.
+const SuperInstruction superInstructions[] = {
+	{OpCode::SenseEntityJump, 5, {OpCode::ResetTargetMarker, OpCode::MoveTargetMarker, OpCode::ContainsEntity, OpCode::CopyResultToPrimary, OpCode::ConditionalJump}},
+	{OpCode::CompareEnergyJump, 5, {OpCode::LiteralPrimary, OpCode::GetEnergy, OpCode::CopyResultToSecondary, OpCode::Greater, OpCode::ConditionalJump}},
+	{OpCode::ContainsEntityJump, 3, {OpCode::ContainsEntity, OpCode::CopyResultToPrimary, OpCode::ConditionalJump}},
+	{OpCode::PrimaryJump, 2, {OpCode::CopyResultToPrimary, OpCode::ConditionalJump}},
+	{OpCode::GreaterJump, 2, {OpCode::Greater, OpCode::ConditionalJump}},
+	{OpCode::SetTargetMarker, 2, {OpCode::ResetTargetMarker, OpCode::MoveTargetMarker}},
+};
+}
+
+Program::Program() {
+
+}
+
+Program Program::compile(const QVector<Instruction> &byteCode, const InstructionHandler *handlers) {
+	Program program;
+	const int size = byteCode.size();
+	program.mInstructions.resize(size);
+	for (int i = 0; i < size; i++) {
+		const Instruction &ins = byteCode.at(i);
+		ProgramInstruction &out = program.mInstructions[i];
+		out.mOpCode = ins.mOpCode < OpCode::MaxOpCode ? ins.mOpCode : OpCode::MaxOpCode;
+		out.mHandler = handlers ? handlers[(int)out.mOpCode] : 0;
+		out.mFusedHandler = 0;
+		out.mFusedOpCode = out.mOpCode;
+		out.mFusedLength = 1;
+		out.mReachable = false;
+		out.mNext = (i + 1) % size;
+		out.mJumpTarget = out.mNext;
+		switch (out.mOpCode) {
+			case OpCode::Move:
+			case OpCode::Attack:
+			case OpCode::MoveTargetMarker:
+				out.mParam = Entity::directionFromParam(ins.mParam);
+				break;
+			case OpCode::Eat:
+			case OpCode::GetFoodLevel:
+				out.mParam = (EntityProperty::ValueType)Entity::foodTypeFromParam(ins.mParam);
+				break;
+			case OpCode::Jump:
+			case OpCode::ConditionalJump: {
+				// A jump of 0 or 1 continues from the next instruction
+				int jump = ins.mParam % size;
+				out.mParam = ins.mParam;
+				out.mJumpTarget = (i + std::max(jump, 1)) % size;
+				break;
+			}
+			default:
+				out.mParam = ins.mParam;
+				break;
+		}
+	}
+	program.markReachable();
+#ifndef NO_SUPERINSTRUCTIONS
+	program.fuseSuperInstructions(handlers);
+#endif
+#ifdef ENABLE_JIT
+	program.mJitCache = QSharedPointer<JitCache>(new JitCache());
+#endif
+	return program;
+}
+
+int Program::reachableInstructionCount() const {
+	int count = 0;
+	for (const ProgramInstruction &ins : mInstructions) {
+		if (ins.mReachable) count++;
+	}
+	return count;
+}
+
+void Program::markReachable() {
+	if (mInstructions.isEmpty()) return;
+	QVector<int> stack;
+	stack.append(0);
+	mInstructions[0].mReachable = true;
+	while (!stack.isEmpty()) {
+		const ProgramInstruction &ins = mInstructions.at(stack.takeLast());
+		int successors[2] = {ins.mNext, ins.mJumpTarget};
+		int successorCount = 2;
+		if (ins.mOpCode == OpCode::Jump) {
+			successors[0] = ins.mJumpTarget;
+			successorCount = 1;
+		}
+		for (int i = 0; i < successorCount; i++) {
+			ProgramInstruction &successor = mInstructions[successors[i]];
+			if (!successor.mReachable) {
+				successor.mReachable = true;
+				stack.append(successors[i]);
+			}
+		}
+	}
+}
+
+void Program::fuseSuperInstructions(const InstructionHandler *handlers) {
+	const int size = mInstructions.size();
+	for (int i = 0; i < size; i++) {
+		ProgramInstruction &head = mInstructions[i];
+		if (!head.mReachable) continue;
+		for (const SuperInstruction &super : superInstructions) {
+			// Sequences don't wrap around the end of the program
+			if (i + super.mLength > size) continue;
+			bool match = true;
+			for (int j = 0; j < super.mLength; j++) {
+				if (mInstructions.at(i + j).mOpCode != super.mSequence[j]) {
+					match = false;
+					break;
+				}
+			}
+			if (match) {
+				head.mFusedOpCode = super.mOpCode;
+				head.mFusedLength = super.mLength;
+				head.mFusedHandler = handlers ? handlers[(int)super.mOpCode] : 0;
+				break;
+			}
+		}
+	}
+}
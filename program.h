@@ -0,0 +1,85 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+#include "entityproperty.h"
+#include <QVector>
+#ifdef ENABLE_JIT
+#include <QSharedPointer>
+#include "jit.h"
+#endif
+
+class Action;
+class Entity;
+class Map;
+enum class OpCode : quint8;
+struct Instruction;
+struct ProgramInstruction;
+
+typedef bool (*InstructionHandler)(Entity *entity, const Map *map, const ProgramInstruction &ins, Action &action);
+
+// Executable form of a single bytecode instruction.
+// Operands of Move, Attack, MoveTargetMarker, Eat and GetFoodLevel are already
+// converted to Direction and FoodType values. Jumps carry the absolute execution
+// point they continue from, so they don't have to step through the bytecode.
+//
+// If a superinstruction starts at this instruction, mFusedOpCode and mFusedLength
+// describe it. The fused instructions themselves are kept as they are, so jumps into
+// the middle of a sequence and a nearly spent instruction budget still work.
+struct ProgramInstruction {
+	InstructionHandler mHandler;
+	InstructionHandler mFusedHandler;
+	OpCode mOpCode;
+	OpCode mFusedOpCode;
+	quint8 mFusedLength;
+	bool mReachable;
+	EntityProperty::ValueType mParam;
+	int mNext;
+	int mJumpTarget;
+};
+
+class Program {
+	public:
+		Program();
+		static Program compile(const QVector<Instruction> &byteCode, const InstructionHandler *handlers = 0);
+
+		const ProgramInstruction &instruction(int executionPoint) const;
+		int size() const;
+		bool isEmpty() const;
+		int reachableInstructionCount() const;
+
+#ifdef ENABLE_JIT
+		const JitCode *nativeCode() const;
+		void reportExecution(int instructions, int population) const;
+#endif
+	private:
+		void markReachable();
+		void fuseSuperInstructions(const InstructionHandler *handlers);
+
+		QVector<ProgramInstruction> mInstructions;
+#ifdef ENABLE_JIT
+		QSharedPointer<JitCache> mJitCache;
+#endif
+};
+
+inline const ProgramInstruction &Program::instruction(int executionPoint) const {
+	return mInstructions.constData()[executionPoint];
+}
+
+inline int Program::size() const {
+	return mInstructions.size();
+}
+
+inline bool Program::isEmpty() const {
+	return mInstructions.isEmpty();
+}
+
+#ifdef ENABLE_JIT
+inline const JitCode *Program::nativeCode() const {
+	return mJitCache->code();
+}
+
+inline void Program::reportExecution(int instructions, int population) const {
+	mJitCache->reportExecution(*this, instructions, population);
+}
+#endif
+
+#endif // PROGRAM_H
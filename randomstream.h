@@ -0,0 +1,63 @@
+#ifndef RANDOMSTREAM_H
+#define RANDOMSTREAM_H
+#include <QtGlobal>
+
+// Counter based random numbers. The n-th number of a stream is a hash of the stream's key
+// and n (splitmix64), so a stream is nothing but a key and a position, and the same key
+// always gives the same numbers, whichever thread draws them. Works with the <random>
+// distributions.
+class RandomStream {
+	public:
+		typedef quint32 result_type;
+
+		explicit RandomStream(quint64 key = 0, quint64 counter = 0);
+
+		// Key of the stream an entity uses for one purpose in one tick
+		static quint64 key(quint64 seed, quint64 id, quint64 tick, quint32 purpose);
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return 0xFFFFFFFFu; }
+		result_type operator()();
+
+		quint64 key() const;
+		// Number of values drawn so far
+		quint64 counter() const;
+	private:
+		static const quint64 Increment = 0x9E3779B97F4A7C15ull;
+
+		static quint64 mix(quint64 x);
+
+		quint64 mKey;
+		quint64 mCounter;
+};
+
+inline RandomStream::RandomStream(quint64 key, quint64 counter) :
+	mKey(key),
+	mCounter(counter) {
+
+}
+
+inline quint64 RandomStream::mix(quint64 x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+inline quint64 RandomStream::key(quint64 seed, quint64 id, quint64 tick, quint32 purpose) {
+	return mix(mix(mix(seed + id * Increment) ^ tick) + purpose);
+}
+
+inline RandomStream::result_type RandomStream::operator()() {
+	mCounter++;
+	return (result_type)(mix(mKey + mCounter * Increment) >> 32);
+}
+
+inline quint64 RandomStream::key() const {
+	return mKey;
+}
+
+inline quint64 RandomStream::counter() const {
+	return mCounter;
+}
+
+#endif // RANDOMSTREAM_H
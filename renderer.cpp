@@ -0,0 +1,84 @@
+#include "renderer.h"
+#include <QMutexLocker>
+
+Renderer::Renderer() :
+	mScheduler(ThreadCount, false),
+	mCurrentImage(0),
+	mBusy(false),
+	mQuit(false) {
+
+}
+
+Renderer::~Renderer() {
+	{
+		QMutexLocker locker(&mMutex);
+		mQuit = true;
+		mWake.wakeAll();
+	}
+	wait();
+}
+
+bool Renderer::submit(const Map *map) {
+	{
+		QMutexLocker locker(&mMutex);
+		if (mBusy) return false;
+	}
+	map->snapshot(mSnapshot);
+
+	QMutexLocker locker(&mMutex);
+	mBusy = true;
+	mWake.wakeAll();
+	return true;
+}
+
+void Renderer::run() {
+	while (true) {
+		{
+			QMutexLocker locker(&mMutex);
+			while (!mBusy && !mQuit) mWake.wait(&mMutex);
+			if (mQuit) return;
+		}
+
+		drawFrame();
+
+		QMutexLocker locker(&mMutex);
+		mBusy = false;
+	}
+}
+
+void Renderer::drawFrame() {
+	if (mSnapshot.noDraw()) {
+		emit frameFinished(QImage());
+		return;
+	}
+	if (mSnapshot.isStatic()) {
+		QImage frame = mStaticFrameCache.find(mSnapshot);
+		if (frame.isNull()) {
+			// Drawn into an image of its own, so the double buffer never shares its pixels
+			frame = QImage(mSnapshot.mWidth, mSnapshot.mHeight, QImage::Format_RGB32);
+			drawSnapshot(frame);
+			mStaticFrameCache.insert(mSnapshot, frame);
+		}
+		emit frameFinished(frame);
+		return;
+	}
+
+	QImage &image = mImages[mCurrentImage];
+	if (image.width() != mSnapshot.mWidth || image.height() != mSnapshot.mHeight) {
+		image = QImage(mSnapshot.mWidth, mSnapshot.mHeight, QImage::Format_RGB32);
+	}
+	drawSnapshot(image);
+	mCurrentImage = 1 - mCurrentImage;
+	emit frameFinished(image);
+}
+
+void Renderer::drawSnapshot(QImage &image) {
+	// bits() detaches the image if the last frame drawn into it is still in use, so it
+	// is called once here and not from the drawing threads
+	uchar *bits = image.bits();
+	const int bytesPerLine = image.bytesPerLine();
+	const MapSnapshot &snapshot = mSnapshot;
+	mScheduler.parallelFor(snapshot.mHeight, RowGrain, [&snapshot, bits, bytesPerLine](int begin, int end) {
+		snapshot.draw(bits, bytesPerLine, begin, end);
+	});
+}
@@ -0,0 +1,53 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+#include "map.h"
+#include "scheduler.h"
+
+// Draws frames of the map on a thread of its own, so the simulation never waits for
+// drawing.
+//
+// submit copies the channels the current draw modes need into a snapshot and returns.
+// The render thread then draws the frame from the snapshot, in bands of rows spread over
+// a small scheduler of its own, and hands it out through frameFinished. While a frame is being
+// drawn submit does nothing, the simulation just tries again later. Frames drawn only
+// from static channels are drawn once and then handed out from a cache.
+class Renderer : public QThread {
+		Q_OBJECT
+	public:
+		static const int RowGrain = 16;
+		// The render thread and one helper. They aren't pinned, so they don't take
+		// turns with the simulation's pinned threads on the same cores.
+		static const int ThreadCount = 2;
+
+		Renderer();
+		~Renderer();
+
+		// Call at a tick boundary. Returns false if the previous frame isn't done yet,
+		// the map isn't looked at in that case.
+		bool submit(const Map *map);
+	signals:
+		void frameFinished(QImage image);
+	protected:
+		void run();
+	private:
+		void drawFrame();
+		void drawSnapshot(QImage &image);
+
+		Scheduler mScheduler;
+		// Only written by submit while no frame is being drawn
+		MapSnapshot mSnapshot;
+		QImage mImages[2];
+		int mCurrentImage;
+		StaticFrameCache mStaticFrameCache;
+
+		QMutex mMutex;
+		QWaitCondition mWake;
+		bool mBusy;
+		bool mQuit;
+};
+
+#endif // RENDERER_H
@@ -0,0 +1,204 @@
+#include "scheduler.h"
+#include <QMutexLocker>
+#include <chrono>
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class Scheduler::WorkerThread : public QThread {
+	public:
+		WorkerThread(Scheduler *scheduler, int thread) :
+			mScheduler(scheduler),
+			mThread(thread) {
+		}
+
+		void run() {
+#ifdef Q_OS_LINUX
+			if (mScheduler->mPinThreads) pinToAllowedCpu();
+#endif
+			mScheduler->threadMain(mThread);
+		}
+	private:
+#ifdef Q_OS_LINUX
+		// Pins the thread to the mThread-th of the CPUs the process may run on, or the next
+		// one that accepts it. The thread stays unpinned if the allowed CPUs can't be read
+		// or none of them accepts it.
+		void pinToAllowedCpu() {
+			cpu_set_t allowed;
+			CPU_ZERO(&allowed);
+			if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+			QVector<int> cpus;
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				if (CPU_ISSET(cpu, &allowed)) cpus.append(cpu);
+			}
+			for (int i = 0; i < cpus.size(); i++) {
+				cpu_set_t pinned;
+				CPU_ZERO(&pinned);
+				CPU_SET(cpus.at((mThread + i) % cpus.size()), &pinned);
+				if (pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) == 0) return;
+			}
+		}
+#endif
+
+		Scheduler *mScheduler;
+		int mThread;
+};
+
+Scheduler::Scheduler(int threadCount, bool pinThreads) :
+	mThreadCount(qMax(1, threadCount)),
+	mPinThreads(pinThreads),
+	mGeneration(0),
+	mRunning(0),
+	mQuit(false),
+	mGrain(1),
+	mRangeFunction(0),
+	mFunction(0),
+	mWallTime(0) {
+	mStates = new ThreadState[mThreadCount];
+	for (int i = 0; i < mThreadCount; i++) {
+		mStates[i].mRange.store(0);
+		mStates[i].mBusyTime = 0;
+	}
+	// The calling thread is thread 0
+	for (int i = 1; i < mThreadCount; i++) {
+		WorkerThread *thread = new WorkerThread(this, i);
+		mThreads.append(thread);
+		thread->start();
+	}
+}
+
+Scheduler::~Scheduler() {
+	{
+		QMutexLocker locker(&mMutex);
+		mQuit = true;
+		mStart.wakeAll();
+	}
+	for (WorkerThread *thread : mThreads) {
+		thread->wait();
+		delete thread;
+	}
+	delete[] mStates;
+}
+
+QVector<double> Scheduler::utilisation() const {
+	QVector<double> utilisation(mThreadCount, 0.0);
+	if (mWallTime == 0) return utilisation;
+	for (int i = 0; i < mThreadCount; i++) {
+		utilisation[i] = (double)mStates[i].mBusyTime / mWallTime;
+	}
+	return utilisation;
+}
+
+void Scheduler::resetUtilisation() {
+	for (int i = 0; i < mThreadCount; i++) {
+		mStates[i].mBusyTime = 0;
+	}
+	mWallTime = 0;
+}
+
+void Scheduler::run(int count, int grain, RangeFunction rangeFunction, const void *function) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	mGrain = qMax(1, grain);
+	mRangeFunction = rangeFunction;
+	mFunction = function;
+	for (int i = 0; i < mThreadCount; i++) {
+		int begin = (qint64)count * i / mThreadCount;
+		int end = (qint64)count * (i + 1) / mThreadCount;
+		mStates[i].mRange.storeRelease(packRange(begin, end));
+	}
+
+	if (mThreadCount > 1) {
+		QMutexLocker locker(&mMutex);
+		mRunning = mThreadCount - 1;
+		mGeneration++;
+		mStart.wakeAll();
+	}
+
+	work(0);
+
+	if (mThreadCount > 1) {
+		QMutexLocker locker(&mMutex);
+		while (mRunning > 0) mDone.wait(&mMutex);
+	}
+	mWallTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Scheduler::threadMain(int thread) {
+	quint64 generation = 0;
+	while (true) {
+		{
+			QMutexLocker locker(&mMutex);
+			while (mGeneration == generation && !mQuit) mStart.wait(&mMutex);
+			if (mQuit) return;
+			generation = mGeneration;
+		}
+
+		work(thread);
+
+		QMutexLocker locker(&mMutex);
+		if (--mRunning == 0) mDone.wakeAll();
+	}
+}
+
+void Scheduler::work(int thread) {
+	qint64 busy = 0;
+	int begin;
+	int end;
+	do {
+		while (takeRange(thread, begin, end)) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			mRangeFunction(mFunction, begin, end);
+			busy += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	} while (steal(thread));
+	mStates[thread].mBusyTime += busy;
+}
+
+bool Scheduler::takeRange(int thread, int &begin, int &end) {
+	QAtomicInteger<quint64> &range = mStates[thread].mRange;
+	while (true) {
+		quint64 current = range.loadAcquire();
+		int first = (int)(current & 0xFFFFFFFF);
+		int last = (int)(current >> 32);
+		if (first >= last) return false;
+		int size = qMin(mGrain, last - first);
+		if (range.testAndSetOrdered(current, packRange(first + size, last))) {
+			begin = first;
+			end = first + size;
+			return true;
+		}
+	}
+}
+
+bool Scheduler::steal(int thread) {
+	while (true) {
+		int victim = -1;
+		quint64 victimRange = 0;
+		int largest = 0;
+		for (int i = 0; i < mThreadCount; i++) {
+			if (i == thread) continue;
+			quint64 current = mStates[i].mRange.loadAcquire();
+			int size = (int)(current >> 32) - (int)(current & 0xFFFFFFFF);
+			if (size > largest) {
+				largest = size;
+				victim = i;
+				victimRange = current;
+			}
+		}
+		if (victim < 0) return false;
+
+		int first = (int)(victimRange & 0xFFFFFFFF);
+		int last = (int)(victimRange >> 32);
+		int split = last - (last - first + 1) / 2;
+		if (mStates[victim].mRange.testAndSetOrdered(victimRange, packRange(first, split))) {
+			mStates[thread].mRange.storeRelease(packRange(split, last));
+			return true;
+		}
+		// The victim or another thief got there first, look again
+	}
+}
+
+quint64 Scheduler::packRange(int begin, int end) {
+	return (quint64)(quint32)begin | ((quint64)(quint32)end << 32);
+}
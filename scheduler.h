@@ -0,0 +1,93 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInteger>
+#include <QVector>
+
+// Persistent worker threads running parallel loops over index ranges.
+//
+// Every parallelFor splits the indices evenly between the threads, the calling thread
+// being one of them. A thread takes grain sized ranges from the front of its own range.
+// Once that is empty it steals the back half of the largest remaining range of another
+// thread, so threads that got cheap entities help out those that got expensive ones.
+// Ranges are packed into one 64 bit atomic per thread, so neither taking nor stealing
+// needs a lock, and nothing is allocated per loop.
+//
+// Worker threads are pinned to one core each where the platform supports it, unless
+// pinThreads is false. Pools that run next to the simulation's shouldn't be pinned, they
+// would compete with its threads for the same cores.
+class Scheduler {
+	public:
+		explicit Scheduler(int threadCount = QThread::idealThreadCount(), bool pinThreads = true);
+		~Scheduler();
+
+		int threadCount() const;
+
+		// Calls function(begin, end) for disjoint ranges covering [0, count) and returns
+		// once all of them are done. Must not be nested.
+		template <class Function>
+		void parallelFor(int count, int grain, const Function &function);
+
+		// Share of the time spent in parallelFor each thread was running ranges, since
+		// the last resetUtilisation. The calling thread comes first.
+		QVector<double> utilisation() const;
+		void resetUtilisation();
+	private:
+		class WorkerThread;
+		typedef void (*RangeFunction)(const void *function, int begin, int end);
+
+		template <class Function>
+		static void callRange(const void *function, int begin, int end);
+
+		void run(int count, int grain, RangeFunction rangeFunction, const void *function);
+		void work(int thread);
+		bool takeRange(int thread, int &begin, int &end);
+		bool steal(int thread);
+		void threadMain(int thread);
+
+		static quint64 packRange(int begin, int end);
+
+		// Padded to a cache line, so threads don't write to each other's lines
+		struct ThreadState {
+			QAtomicInteger<quint64> mRange;
+			qint64 mBusyTime;
+			char mPadding[48];
+		};
+
+		QVector<WorkerThread*> mThreads;
+		ThreadState *mStates;
+		int mThreadCount;
+		bool mPinThreads;
+
+		QMutex mMutex;
+		QWaitCondition mStart;
+		QWaitCondition mDone;
+		quint64 mGeneration;
+		int mRunning;
+		bool mQuit;
+
+		int mGrain;
+		RangeFunction mRangeFunction;
+		const void *mFunction;
+
+		qint64 mWallTime;
+};
+
+inline int Scheduler::threadCount() const {
+	return mThreadCount;
+}
+
+template <class Function>
+void Scheduler::callRange(const void *function, int begin, int end) {
+	(*static_cast<const Function*>(function))(begin, end);
+}
+
+template <class Function>
+void Scheduler::parallelFor(int count, int grain, const Function &function) {
+	if (count <= 0) return;
+	run(count, grain, &Scheduler::callRange<Function>, &function);
+}
+
+#endif // SCHEDULER_H
@@ -0,0 +1,71 @@
+#include "speedsorter.h"
+#include "action.h"
+#include "entity.h"
+#include "map.h"
+#include <algorithm>
+
+SpeedSorter::SpeedSorter() :
+	mSize(0) {
+
+}
+
+void SpeedSorter::clear() {
+	mSize = 0;
+}
+
+void SpeedSorter::append(const Action *action, const Map *map) {
+	if (mSize == mKeys.size()) mKeys.resize(qMax(1024, mSize * 2));
+	// Can be smaller than mKeys after sort swapped it out
+	if (mSize >= mActions.size()) mActions.resize(mKeys.size());
+	mKeys[mSize] = std::max(action->speed().value(), action->entity(map)->energy().value());
+	mActions[mSize] = action;
+	mSize++;
+}
+
+const QVector<const Action*> &SpeedSorter::sort() {
+	mSortedKeys.resize(mSize);
+	mSorted.resize(mSize);
+	if (mSize == 0) return mSorted;
+
+	int lowCounts[256] = {};
+	int highCounts[256] = {};
+	const EntityProperty::ValueType *keys = mKeys.constData();
+	const Action *const *actions = mActions.constData();
+	for (int i = 0; i < mSize; i++) {
+		lowCounts[keys[i] & 0xFF]++;
+		highCounts[keys[i] >> 8]++;
+	}
+
+	// Descending bucket offsets
+	int lowOffsets[256];
+	int highOffsets[256];
+	int low = 0;
+	int high = 0;
+	for (int digit = 255; digit >= 0; digit--) {
+		lowOffsets[digit] = low;
+		low += lowCounts[digit];
+		highOffsets[digit] = high;
+		high += highCounts[digit];
+	}
+
+	// The first pass reads backwards, which puts equal keys in reverse append order.
+	// The second pass is stable and keeps that.
+	EntityProperty::ValueType *sortedKeys = mSortedKeys.data();
+	const Action **sorted = mSorted.data();
+	for (int i = mSize - 1; i >= 0; i--) {
+		int index = lowOffsets[keys[i] & 0xFF]++;
+		sortedKeys[index] = keys[i];
+		sorted[index] = actions[i];
+	}
+
+	// All keys share the high byte, nothing left to do
+	if (highCounts[sortedKeys[0] >> 8] == mSize) return mSorted;
+
+	const Action **out = mActions.data();
+	for (int i = 0; i < mSize; i++) {
+		out[highOffsets[sortedKeys[i] >> 8]++] = sorted[i];
+	}
+	mActions.resize(mSize);
+	mActions.swap(mSorted);
+	return mSorted;
+}
@@ -0,0 +1,38 @@
+#ifndef SPEEDSORTER_H
+#define SPEEDSORTER_H
+#include "entityproperty.h"
+#include <QVector>
+
+class Action;
+class Map;
+
+// Orders the speed sorted actions of a tick, fastest first, with a two pass radix sort
+// on the 16 bit key max(speed, energy). Actions with the same key are ordered last
+// appended first, the order the multimap based resolution had.
+//
+// The buffers are kept between ticks, so a sorter reused every tick doesn't allocate
+// once it has seen the largest tick.
+class SpeedSorter {
+	public:
+		SpeedSorter();
+
+		void clear();
+		// The key is taken from the action's entity now
+		void append(const Action *action, const Map *map);
+		int size() const;
+
+		// Valid until the next sort
+		const QVector<const Action*> &sort();
+	private:
+		QVector<EntityProperty::ValueType> mKeys;
+		QVector<const Action*> mActions;
+		QVector<EntityProperty::ValueType> mSortedKeys;
+		QVector<const Action*> mSorted;
+		int mSize;
+};
+
+inline int SpeedSorter::size() const {
+	return mSize;
+}
+
+#endif // SPEEDSORTER_H
@@ -1,15 +1,23 @@
 #include "worker.h"
-#include "entityupdatetask.h"
-#include "action.h"
 #include <chrono>
 
-const int entitiesPerTask = 1500;
 #define DRAW_TIMEOUT 70
+const int FoodLevelGrain = 16384;
 Worker::Worker(Map *map) :
 	mMap(map),
+#ifdef NO_THREADS
+	mScheduler(1),
+#endif
+	mUpdater(map),
+	mActionResolver(map, &mScheduler),
 	mRunning(false){
 	mDrawTimeout = DRAW_TIMEOUT;
 	setAutoDelete(false);
+#ifndef NO_THREADS
+	// Frames go out straight from the render thread
+	connect(&mRenderer, &Renderer::frameFinished, this, &Worker::drawFinished, Qt::DirectConnection);
+	mRenderer.start();
+#endif
 }
 
 Worker::~Worker() {
@@ -21,76 +29,69 @@ void Worker::run() {
 	WorkResults results;
 	std::chrono::time_point<std::chrono::high_resolution_clock> startTime, execEndTime, totalEndTime;
 	while (mRunning) {
-		mMap->updateFoodLevels();
-		QVector<Entity*> taskData;
-		QVector<EntityUpdateTask*> tasks;
-		quint64 generation = 0;
+#ifdef LAZY_TILES
+		mScheduler.parallelFor(mMap->entities().size(), EntityUpdater::ActionGrain, [this](int begin, int end) {
+			mMap->updateOccupiedFoodLevels(begin, end);
+		});
+#else
+		// Bands of whole rows, at least FoodLevelGrain tiles each
+		mScheduler.parallelFor(mMap->height(), qMax(1, FoodLevelGrain / mMap->width()), [this](int begin, int end) {
+			mMap->updateFoodLevels(begin, end);
+		});
+#endif
+		mMap->advanceTick();
 		startTime = std::chrono::high_resolution_clock::now();
-		for (Entity *e : mMap->entities()) {
-			if (e->generation() > generation) generation = e->generation();
-			taskData.append(e);
-			if (taskData.size() == entitiesPerTask) {
-				EntityUpdateTask *task = new EntityUpdateTask(mMap, taskData);
-				tasks.append(task);
-	#ifndef NO_THREADS
-				mThreadPool.start(task);
-	#endif
-				taskData.clear();
-			}
-		}
-
-
-		if (!taskData.isEmpty()) {
-			EntityUpdateTask *task = new EntityUpdateTask(mMap, taskData);
-			tasks.append(task);
-	#ifndef NO_THREADS
-			mThreadPool.start(task);
-	#endif
-		}
 
 		if (mLastUpdate.elapsed() > mDrawTimeout) {
+#ifdef NO_THREADS
 			emit drawFinished(mMap->draw());
 			mLastUpdate.restart();
+#else
+			if (mRenderer.submit(mMap)) mLastUpdate.restart();
+#endif
 		}
 
-	#ifdef NO_THREADS
-		for (EntityUpdateTask *task : tasks) task->run();
-	#else
-		mThreadPool.waitForDone();
-	#endif
+		mUpdater.beginTick();
+		mScheduler.parallelFor(mUpdater.size(), EntityUpdater::ActionGrain, [this](int begin, int end) {
+			mUpdater.beginUpdates(begin, end);
+		});
+		mScheduler.parallelFor(mUpdater.size(), EntityUpdater::ProgramGrain, [this](int begin, int end) {
+			mUpdater.runPrograms(begin, end);
+		});
 		execEndTime = std::chrono::high_resolution_clock::now();
 
+		mUpdater.reserveChildren();
+		mScheduler.parallelFor(mUpdater.size(), EntityUpdater::ActionGrain, [this](int begin, int end) {
+			mUpdater.execThreadedActions(begin, end);
+		});
 
-		std::multimap<EntityProperty::ValueType, Action*> speedSortedActions;
-		for (EntityUpdateTask *task : tasks) {
-			for (Action *action : task->actions()) {
-				if (action->shouldBeSpeedSorted())
-					speedSortedActions.insert(std::pair<EntityProperty::ValueType, Action*>(std::max(action->speed().value(), action->entity()->energy().value()), action));
-				else {
-					EntityProperty result = action->exec(mMap);
-					action->entity()->reportActionResult(result);
-					delete action;
-				}
+		mSpeedSorter.clear();
+		for (const Action &action : mUpdater.actions()) {
+			if (action.isNone()) continue;
+			if (action.shouldBeSpeedSorted())
+				mSpeedSorter.append(&action, mMap);
+			else {
+				EntityProperty result = action.exec(mMap);
+				action.entity(mMap)->reportActionResult(result);
 			}
-			delete task;
 		}
 
-		if (!speedSortedActions.empty()) {
-			auto it = speedSortedActions.end();
-			do {
-				--it;
-				EntityProperty result = it->second->exec(mMap);
-				it->second->entity()->reportActionResult(result);
-				delete it->second;
-			} while (it != speedSortedActions.begin());
-		}
+		mActionResolver.exec(mSpeedSorter.sort());
 
-		mMap->deletePass();
+		mScheduler.parallelFor(mMap->entities().size(), EntityUpdater::ActionGrain, [this](int begin, int end) {
+			mMap->markDeadEntities(begin, end);
+		});
+		mMap->removeDeadEntities();
 		if (mMap->entities().size() < 5000) {
 			for (int i = 0; i < 30; i++) {
 				mMap->createAndRandomPlaceEntity();
 			}
 		}
+#ifdef SORT_ENTITIES
+		if (mMap->tick() % Map::EntitySortInterval == 0) mMap->sortEntities();
+#elif !defined(SWAP_REMOVE_DEAD_ENTITIES)
+		mMap->orderNewEntities();
+#endif
 		totalEndTime = std::chrono::high_resolution_clock::now();
 
 		if (mMap->tick() % 20000 == 0) {
@@ -98,19 +99,35 @@ void Worker::run() {
 		}
 
 		results.mEntities = mMap->entities().size();
-		results.mGeneration = generation;
-		results.mTaskSize = tasks.size();
 		results.mTicks = mMap->tick();
 		results.mExecutionTime = std::chrono::duration_cast<std::chrono::microseconds>(execEndTime - startTime).count();
 		results.mTotalTime = std::chrono::duration_cast<std::chrono::microseconds>(totalEndTime - startTime).count();
 		if (mMap->tick() % 5 == 0) {
+			results.mThreadUtilisation = mScheduler.utilisation();
+			mScheduler.resetUtilisation();
+			collectStatistics(results);
 			emit workResults(results);
 		}
 	}
+	collectStatistics(results);
 	emit workResults(results);
 	emit finished();
 }
 
+void Worker::collectStatistics(WorkResults &results) {
+	results.mGeneration = 0;
+	results.mStoreEntries = 0;
+	for (const Entity *e : mMap->entities()) {
+		if (e->generation() > results.mGeneration) results.mGeneration = e->generation();
+		results.mStoreEntries += e->store().size();
+	}
+	// The entity's own store and the copy in its sensed state
+	results.mStoreMemory = mMap->entities().size() * 2 * EntityStore::memoryUsage();
+#ifdef DECISION_MEMO
+	results.mMemo = mMap->takeMemoStatistics();
+#endif
+}
+
 void Worker::stop() {
 	mRunning = false;
 }
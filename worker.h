@@ -3,15 +3,27 @@
 #include <QRunnable>
 #include <QTime>
 #include "map.h"
-#include <QThreadPool>
+#include "speedsorter.h"
+#include "actionresolver.h"
+#include "scheduler.h"
+#include "entityupdater.h"
+#include "renderer.h"
 
 struct WorkResults {
 	int mEntities;
 	quint64 mTicks;
 	quint64 mGeneration;
-	int mTaskSize;
+	// Share of the parallel loops each thread spent working, see Scheduler::utilisation
+	QVector<double> mThreadUtilisation;
 	double mTotalTime;
 	double mExecutionTime;
+	int mStoreEntries;
+	// Counts both stores of every entity, see EntitySensedState
+	int mStoreMemory;
+#ifdef DECISION_MEMO
+	// Since the previous results
+	DecisionMemoStatistics mMemo;
+#endif
 };
 
 Q_DECLARE_METATYPE(WorkResults)
@@ -28,10 +40,21 @@ class Worker : public QObject, public QRunnable {
 		void workResults(WorkResults results);
 		void drawFinished(QImage img);
 	private:
+		// Fills in the results that need a walk over all entities or genomes. The entity
+		// walk reads their cold data and stores, so it only runs for the results that are
+		// sent out.
+		void collectStatistics(WorkResults &results);
+
 		Map *mMap;
 		QTime mLastUpdate;
-		QThreadPool mThreadPool;
+		Scheduler mScheduler;
 		int mDrawTimeout;
+		EntityUpdater mUpdater;
+		SpeedSorter mSpeedSorter;
+		ActionResolver mActionResolver;
+#ifndef NO_THREADS
+		Renderer mRenderer;
+#endif
 		volatile bool mRunning;
 };
 